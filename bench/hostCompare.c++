@@ -0,0 +1,348 @@
+// hostCompare.c++: The host engine (common/HostCompute.h) against OpenCL on
+// the CPU and against plain loops.
+//
+// For vecadd (ex 1), saxpy and daxpy (ex 3), and matrixMultiply (ex 4, V1)
+// at each problem size, times three ways of computing the same result:
+//   naive   plain single-threaded loops
+//   host    hostVecaddTrig, hostSaxpy, hostDaxpy, and hostMatrixMultiply,
+//           with SIMD instructions and every core
+//   opencl  the example's kernel on a CPU OpenCL device (e.g., PoCL),
+//           including the writes and the reads, as the examples see it
+// Each time is the fastest of "reps" runs, on the host's clock. The host and
+// OpenCL results are compared with the naive ones, and the program exits
+// non-zero if any differs by more than rounding allows. With no CPU OpenCL
+// device (or with -noopencl), only naive and host are compared.
+//
+// Usage: hostCompare [-sizes=<n>,...] [-msizes=<N>,...] [-reps=<count>] [-noopencl]
+//
+// $GPGPU_HOST_THREADS and $GPGPU_HOST_SIMD choose what the host engine
+// uses, e.g., to see what each instruction set is worth.
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <math.h>
+
+#include "OpenCLRuntime.h"
+#include "HostCompute.h"
+
+static const char* vecaddSource = "../ex 1/SimpleOpenCL.cl";
+static const char* saxpySource = "../ex 3/saxpy.cl";
+static const char* daxpySource = "../ex 3/daxpy.cl";
+static const char* matrixMultiplySource = "../ex 4/matrixMultiplyV1.cl";
+
+// One host<->device copy per run
+struct Transfer
+{
+	cl_mem buf;
+	size_t bytes;
+	void* host;
+};
+
+struct Comparison
+{
+	std::string kernelName;
+	size_t size;        // n for vectors; N for N x N matrices
+	double naiveMs, hostMs, openclMs; // openclMs < 0: not run
+	double hostDiff, openclDiff;      // largest differences from naive
+	bool ok;
+};
+
+std::vector<size_t> parseList(const char* s)
+{
+	std::vector<size_t> values;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			values.push_back(atol(item.c_str()));
+	return values;
+}
+
+// The fastest of "reps" calls of f, in milliseconds
+template <typename F>
+double bestMs(int reps, F f)
+{
+	double best = 0.0;
+	for (int rep=0 ; rep<reps ; rep++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		f();
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		if ((rep == 0) || (elapsed.count() < best))
+			best = elapsed.count();
+	}
+	return best;
+}
+
+// The largest |x - ref| / max(|ref|, 1): relative for large values,
+// absolute for small ones. NaN counts as infinitely different.
+template <typename T>
+double maxDifference(const T* x, const T* ref, size_t n)
+{
+	double maxDiff = 0.0;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		double diff = fabs(static_cast<double>(x[i]) - ref[i]) / std::max(fabs(static_cast<double>(ref[i])), 1.0);
+		if (!(diff <= maxDiff))
+			maxDiff = isnan(diff) ? INFINITY : diff;
+	}
+	return maxDiff;
+}
+
+// Writes "writes", runs "kernel" (whose arguments are already set) with
+// the implementation's choice of local size, and reads "reads", as one
+// blocking sequence
+void runOnDevice(OpenCLRuntime& rt, cl_kernel kernel, cl_uint dims, const size_t* global,
+	const std::vector<Transfer>& writes, const std::vector<Transfer>& reads)
+{
+	cl_command_queue cmdQueue = rt.queue();
+	for (size_t i=0 ; i<writes.size() ; i++)
+	{
+		cl_int status = clEnqueueWriteBuffer(cmdQueue, writes[i].buf, CL_FALSE, 0, writes[i].bytes,
+			writes[i].host, 0, nullptr, nullptr);
+		checkStatus("clEnqueueWriteBuffer", status, true);
+	}
+	cl_int status = clEnqueueNDRangeKernel(cmdQueue, kernel, dims, nullptr, global, nullptr, 0, nullptr, nullptr);
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+	for (size_t i=0 ; i<reads.size() ; i++)
+	{
+		status = clEnqueueReadBuffer(cmdQueue, reads[i].buf, CL_FALSE, 0, reads[i].bytes,
+			reads[i].host, 0, nullptr, nullptr);
+		checkStatus("clEnqueueReadBuffer", status, true);
+	}
+	clFinish(cmdQueue);
+}
+
+Comparison compareVecadd(OpenCLRuntime* rt, size_t n, int reps)
+{
+	Comparison c = { "vecadd", n, 0.0, 0.0, -1.0, 0.0, 0.0, true };
+	std::vector<float> A(n), B(n), ref(2*n), C(2*n);
+	for (size_t i=0 ; i<n ; i++)
+	{
+		A[i] = (i % 360) * 0.0174533f;
+		B[i] = (i % 180) * 0.0174533f;
+	}
+	// float cos and sin can differ by a few ulps between implementations
+	double tolerance = 1.0e-5;
+
+	c.naiveMs = bestMs(reps, [&]
+	{
+		for (size_t i=0 ; i<n ; i++)
+		{
+			ref[2*i] = cosf(A[i]);
+			ref[2*i+1] = sinf(B[i]);
+		}
+	});
+	c.hostMs = bestMs(reps, [&] { hostVecaddTrig(A.data(), B.data(), C.data(), n); });
+	c.hostDiff = maxDifference(C.data(), ref.data(), 2*n);
+	c.ok = c.hostDiff <= tolerance;
+
+	if (rt != nullptr)
+	{
+		cl_kernel kernel = rt->kernel(vecaddSource, "vecadd");
+		MemHandle d_A = rt->createBuffer(CL_MEM_READ_ONLY, n * sizeof(float));
+		MemHandle d_B = rt->createBuffer(CL_MEM_READ_ONLY, n * sizeof(float));
+		MemHandle d_C = rt->createBuffer(CL_MEM_WRITE_ONLY, 2 * n * sizeof(float));
+		int iN = n;
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+		clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		std::vector<Transfer> writes = { { d_A, n * sizeof(float), A.data() }, { d_B, n * sizeof(float), B.data() } };
+		std::vector<Transfer> reads = { { d_C, 2 * n * sizeof(float), C.data() } };
+		size_t global[1] = { n };
+		c.openclMs = bestMs(reps, [&] { runOnDevice(*rt, kernel, 1, global, writes, reads); });
+		c.openclDiff = maxDifference(C.data(), ref.data(), 2*n);
+		c.ok = c.ok && (c.openclDiff <= tolerance);
+	}
+	return c;
+}
+
+// saxpy (T = float) or daxpy (T = double)
+template <typename T>
+Comparison compareAxpy(OpenCLRuntime* rt, const char* source, const char* name, size_t n, int reps,
+	void (*hostAxpy)(T, const T*, const T*, size_t, T*))
+{
+	Comparison c = { name, n, 0.0, 0.0, -1.0, 0.0, 0.0, true };
+	T a = 2.5;
+	std::vector<T> X(n), Y(n), ref(n), Z(n);
+	for (size_t i=0 ; i<n ; i++)
+	{
+		X[i] = (i % 1000) * 0.125;
+		Y[i] = 10.0 + (i % 7);
+	}
+	// Fused multiply-adds round once, not twice
+	double tolerance = (sizeof(T) == sizeof(float)) ? 1.0e-6 : 1.0e-15;
+
+	c.naiveMs = bestMs(reps, [&]
+	{
+		for (size_t i=0 ; i<n ; i++)
+			ref[i] = a * X[i] + Y[i];
+	});
+	c.hostMs = bestMs(reps, [&] { hostAxpy(a, X.data(), Y.data(), n, Z.data()); });
+	c.hostDiff = maxDifference(Z.data(), ref.data(), n);
+	c.ok = c.hostDiff <= tolerance;
+
+	if (rt != nullptr)
+	{
+		cl_kernel kernel = rt->kernel(source, name);
+		MemHandle d_X = rt->createBuffer(CL_MEM_READ_ONLY, n * sizeof(T));
+		MemHandle d_Y = rt->createBuffer(CL_MEM_READ_ONLY, n * sizeof(T));
+		MemHandle d_Z = rt->createBuffer(CL_MEM_WRITE_ONLY, n * sizeof(T));
+		int iN = n;
+		clSetKernelArg(kernel, 0, sizeof(T), &a);
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_X.get());
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_Y.get());
+		clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		clSetKernelArg(kernel, 4, sizeof(cl_mem), &d_Z.get());
+		std::vector<Transfer> writes = { { d_X, n * sizeof(T), X.data() }, { d_Y, n * sizeof(T), Y.data() } };
+		std::vector<Transfer> reads = { { d_Z, n * sizeof(T), Z.data() } };
+		size_t global[1] = { n };
+		c.openclMs = bestMs(reps, [&] { runOnDevice(*rt, kernel, 1, global, writes, reads); });
+		c.openclDiff = maxDifference(Z.data(), ref.data(), n);
+		c.ok = c.ok && (c.openclDiff <= tolerance);
+	}
+	return c;
+}
+
+Comparison compareMatrixMultiply(OpenCLRuntime* rt, size_t N, int reps)
+{
+	Comparison c = { "matrixMultiply", N, 0.0, 0.0, -1.0, 0.0, 0.0, true };
+	std::vector<double> A(N*N), B(N*N), ref(N*N), C(N*N);
+	for (size_t i=0 ; i<N*N ; i++)
+	{
+		A[i] = (i % 17) * 0.5;
+		B[i] = (i % 13) * 0.25;
+	}
+	// The sums are added up in different orders
+	double tolerance = 1.0e-12 * N;
+
+	c.naiveMs = bestMs(reps, [&]
+	{
+		for (size_t row=0 ; row<N ; row++)
+			for (size_t col=0 ; col<N ; col++)
+			{
+				double sum = 0.0;
+				for (size_t k=0 ; k<N ; k++)
+					sum += A[row*N + k] * B[k*N + col];
+				ref[row*N + col] = sum;
+			}
+	});
+	c.hostMs = bestMs(reps, [&] { hostMatrixMultiply(A.data(), B.data(), C.data(), N, N, N); });
+	c.hostDiff = maxDifference(C.data(), ref.data(), N*N);
+	c.ok = c.hostDiff <= tolerance;
+
+	if (rt != nullptr)
+	{
+		cl_kernel kernel = rt->kernel(matrixMultiplySource, "matrixMultiply");
+		size_t bytes = N * N * sizeof(double);
+		MemHandle d_A = rt->createBuffer(CL_MEM_READ_ONLY, bytes);
+		MemHandle d_B = rt->createBuffer(CL_MEM_READ_ONLY, bytes);
+		MemHandle d_C = rt->createBuffer(CL_MEM_WRITE_ONLY, bytes);
+		int iN = N;
+		clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+		clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+		clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+		clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		std::vector<Transfer> writes = { { d_A, bytes, A.data() }, { d_B, bytes, B.data() } };
+		std::vector<Transfer> reads = { { d_C, bytes, C.data() } };
+		size_t global[2] = { N, N };
+		c.openclMs = bestMs(reps, [&] { runOnDevice(*rt, kernel, 2, global, writes, reads); });
+		c.openclDiff = maxDifference(C.data(), ref.data(), N*N);
+		c.ok = c.ok && (c.openclDiff <= tolerance);
+	}
+	return c;
+}
+
+void printTable(const std::vector<Comparison>& results)
+{
+	std::cout << std::left << std::setw(16) << "kernel" << std::right << std::setw(10) << "size"
+	          << std::setw(12) << "naive ms" << std::setw(12) << "host ms" << std::setw(9) << "(x)"
+	          << std::setw(12) << "opencl ms" << std::setw(9) << "(x)"
+	          << std::setw(12) << "host diff" << std::setw(12) << "cl diff" << "  check\n";
+	for (size_t i=0 ; i<results.size() ; i++)
+	{
+		const Comparison& c = results[i];
+		std::cout << std::left << std::setw(16) << c.kernelName << std::right << std::setw(10) << c.size
+		          << std::fixed << std::setprecision(3)
+		          << std::setw(12) << c.naiveMs << std::setw(12) << c.hostMs
+		          << std::setprecision(1) << std::setw(9) << (c.naiveMs / c.hostMs);
+		if (c.openclMs >= 0.0)
+			std::cout << std::setprecision(3) << std::setw(12) << c.openclMs
+			          << std::setprecision(1) << std::setw(9) << (c.naiveMs / c.openclMs);
+		else
+			std::cout << std::setw(12) << "-" << std::setw(9) << "-";
+		std::cout << std::scientific << std::setprecision(2) << std::setw(12) << c.hostDiff;
+		if (c.openclMs >= 0.0)
+			std::cout << std::setw(12) << c.openclDiff;
+		else
+			std::cout << std::setw(12) << "-";
+		std::cout << (c.ok ? "  ok" : "  WRONG") << '\n';
+		std::cout.unsetf(std::ios::floatfield);
+	}
+	std::cout << "(x): speedup over naive\n";
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<size_t> sizes = { 1 << 12, 1 << 16, 1 << 20, 1 << 24 };
+	std::vector<size_t> matrixSizes = { 32, 128, 256, 512 };
+	int reps = 5;
+	bool useOpenCL = true;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (strcmp("-debug", argv[i]) == 0)
+			debug = true;
+		else if (strcmp("-noopencl", argv[i]) == 0)
+			useOpenCL = false;
+		else if (strncmp("-sizes=", argv[i], 7) == 0)
+			sizes = parseList(argv[i]+7);
+		else if (strncmp("-msizes=", argv[i], 8) == 0)
+			matrixSizes = parseList(argv[i]+8);
+		else if (strncmp("-reps=", argv[i], 6) == 0)
+			reps = atoi(argv[i]+6);
+	}
+	if (reps < 1)
+	{
+		std::cerr << "Need reps >= 1.\n";
+		return 1;
+	}
+
+	std::cout << "Host engine: " << hostSimdName(hostSimdLevel()) << ", "
+	          << ThreadPool::get().size() << " threads\n";
+	OpenCLRuntime* rt = useOpenCL ? OpenCLRuntime::get(CL_DEVICE_TYPE_CPU) : nullptr;
+	bool fp64 = false;
+	if (rt != nullptr)
+	{
+		std::cout << "OpenCL device: " << getDeviceString(rt->device(), CL_DEVICE_NAME) << '\n';
+		fp64 = deviceSupportsFP64(rt->device());
+		if (!fp64)
+			std::cout << "(No double precision on this device; daxpy and matrixMultiply run on the host only)\n";
+	}
+	else
+		std::cout << "No CPU OpenCL device; comparing the host engine with plain loops only\n";
+	std::cout << '\n';
+
+	std::vector<Comparison> results;
+	for (size_t s=0 ; s<sizes.size() ; s++)
+		results.push_back(compareVecadd(rt, sizes[s], reps));
+	for (size_t s=0 ; s<sizes.size() ; s++)
+		results.push_back(compareAxpy<float>(rt, saxpySource, "saxpy", sizes[s], reps, hostSaxpy));
+	for (size_t s=0 ; s<sizes.size() ; s++)
+		results.push_back(compareAxpy<double>(fp64 ? rt : nullptr, daxpySource, "daxpy", sizes[s], reps, hostDaxpy));
+	for (size_t s=0 ; s<matrixSizes.size() ; s++)
+		results.push_back(compareMatrixMultiply(fp64 ? rt : nullptr, matrixSizes[s], reps));
+
+	printTable(results);
+
+	bool ok = true;
+	for (size_t i=0 ; i<results.size() ; i++)
+		ok = ok && results[i].ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,475 @@
+// kernelBench.c++: Device-side timings of the examples' kernels.
+//
+// Runs vecadd (ex 1), saxpy and daxpy (ex 3), and matrixMultiply (ex 4, V1)
+// over a sweep of problem sizes and work-group ("local") sizes. Each
+// configuration is run "warmup" times untimed and then "reps" times with
+// the queue's profiling enabled; the host->device writes, the kernel, and
+// the device->host reads are timed separately from their events'
+// CL_PROFILING_COMMAND_START/END. Results go to stdout as a table and to a
+// JSON file meant to be kept and diffed between versions.
+//
+// Usage: kernelBench [-a|-c|-g] [-kernels=<name>,...] [-sizes=<n>,...]
+//                    [-msizes=<N>,...] [-local=<size>,...] [-local2d=<edge>,...]
+//                    [-warmup=<count>] [-reps=<count>] [-json=<file>]
+//
+// A local size of 0 lets the implementation choose. Local sizes a kernel
+// or device cannot use are skipped; the global size is rounded up to a
+// multiple of the rest. Works the same on CPU and GPU devices (e.g., "-c"
+// with a CPU ICD such as PoCL on a machine with no GPU).
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <math.h>
+
+#include "OpenCLRuntime.h"
+#include "Profiling.h"
+
+static const char* vecaddSource = "../ex 1/SimpleOpenCL.cl";
+static const char* saxpySource = "../ex 3/saxpy.cl";
+static const char* daxpySource = "../ex 3/daxpy.cl";
+static const char* matrixMultiplySource = "../ex 4/matrixMultiplyV1.cl";
+
+// One host<->device copy per repetition
+struct Transfer
+{
+	cl_mem buf;
+	size_t bytes;
+	void* host;
+};
+
+struct Launch
+{
+	std::string kernelName;
+	size_t size;       // n for vectors; N for N x N matrices
+	cl_uint dims;
+	size_t global[2];
+	size_t local[2];   // local[0] == 0: let the implementation choose
+	double bytes;      // the data the kernel must read and write, once each
+	double flops;
+};
+
+struct Result
+{
+	Launch launch;
+	TimingSummary kernelMs, writeMs, readMs;
+	bool ok;
+};
+
+std::vector<size_t> parseList(const char* s)
+{
+	std::vector<size_t> values;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			values.push_back(atol(item.c_str()));
+	return values;
+}
+
+size_t roundUp(size_t value, size_t multiple)
+{
+	return ((value + multiple - 1) / multiple) * multiple;
+}
+
+// Can "kernel" run with work-groups of local[0] x local[1] on this device?
+bool localSizeFits(OpenCLRuntime& rt, cl_kernel kernel, const size_t* local, cl_uint dims)
+{
+	if (local[0] == 0)
+		return true;
+	size_t kernelMax = 0;
+	clGetKernelWorkGroupInfo(kernel, rt.device(), CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &kernelMax, nullptr);
+	size_t itemSizes[3] = { 0, 0, 0 };
+	clGetDeviceInfo(rt.device(), CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(itemSizes), itemSizes, nullptr);
+	size_t total = 1;
+	for (cl_uint d=0 ; d<dims ; d++)
+	{
+		if (local[d] > itemSizes[d])
+			return false;
+		total *= local[d];
+	}
+	return total <= kernelMax;
+}
+
+// Runs "launch" (whose kernel arguments are already set) warmup + reps
+// times, each time writing "writes", running the kernel, and reading
+// "reads". The host arrays in "reads" hold the last repetition's results.
+Result timeLaunch(cl_command_queue cmdQueue, cl_kernel kernel, const Launch& launch,
+	const std::vector<Transfer>& writes, const std::vector<Transfer>& reads, int warmup, int reps)
+{
+	std::vector<double> kernelMs, writeMs, readMs;
+	for (int rep=-warmup ; rep<reps ; rep++)
+	{
+		std::vector<EventHandle> writeEvents, readEvents;
+		cl_event ev;
+		for (size_t i=0 ; i<writes.size() ; i++)
+		{
+			cl_int status = clEnqueueWriteBuffer(cmdQueue, writes[i].buf, CL_FALSE, 0, writes[i].bytes,
+				writes[i].host, 0, nullptr, &ev);
+			checkStatus("clEnqueueWriteBuffer", status, true);
+			writeEvents.push_back(EventHandle(ev));
+		}
+		cl_int status = clEnqueueNDRangeKernel(cmdQueue, kernel, launch.dims, nullptr, launch.global,
+			(launch.local[0] == 0) ? nullptr : launch.local, 0, nullptr, &ev);
+		checkStatus("clEnqueueNDRangeKernel-" + launch.kernelName, status, true);
+		EventHandle kernelEvent(ev);
+		for (size_t i=0 ; i<reads.size() ; i++)
+		{
+			status = clEnqueueReadBuffer(cmdQueue, reads[i].buf, CL_FALSE, 0, reads[i].bytes,
+				reads[i].host, 0, nullptr, &ev);
+			checkStatus("clEnqueueReadBuffer", status, true);
+			readEvents.push_back(EventHandle(ev));
+		}
+		clFinish(cmdQueue);
+		if (rep < 0)
+			continue;
+
+		double ms = 0.0;
+		for (size_t i=0 ; i<writeEvents.size() ; i++)
+			ms += profiledMilliseconds(writeEvents[i]);
+		writeMs.push_back(ms);
+		kernelMs.push_back(profiledMilliseconds(kernelEvent));
+		ms = 0.0;
+		for (size_t i=0 ; i<readEvents.size() ; i++)
+			ms += profiledMilliseconds(readEvents[i]);
+		readMs.push_back(ms);
+	}
+	Result r;
+	r.launch = launch;
+	r.kernelMs = summarize(kernelMs);
+	r.writeMs = summarize(writeMs);
+	r.readMs = summarize(readMs);
+	r.ok = true;
+	return r;
+}
+
+void benchVecadd(OpenCLRuntime& rt, cl_command_queue cmdQueue, const std::vector<size_t>& sizes,
+	const std::vector<size_t>& locals, int warmup, int reps, std::vector<Result>& results)
+{
+	cl_kernel kernel = rt.kernel(vecaddSource, "vecadd");
+	for (size_t s=0 ; s<sizes.size() ; s++)
+	{
+		size_t n = sizes[s];
+		std::vector<float> A(n), B(n), C(2*n);
+		for (size_t i=0 ; i<n ; i++)
+		{
+			A[i] = (i % 360) * 0.0174533f;
+			B[i] = (i % 180) * 0.0174533f;
+		}
+		MemHandle d_A = rt.createBuffer(CL_MEM_READ_ONLY, n * sizeof(float));
+		MemHandle d_B = rt.createBuffer(CL_MEM_READ_ONLY, n * sizeof(float));
+		MemHandle d_C = rt.createBuffer(CL_MEM_WRITE_ONLY, 2 * n * sizeof(float));
+		int iN = n;
+		cl_int status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+		status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+		status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+		status |= clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		checkStatus("clSetKernelArg-vecadd", status, true);
+		std::vector<Transfer> writes = { { d_A, n * sizeof(float), A.data() }, { d_B, n * sizeof(float), B.data() } };
+		std::vector<Transfer> reads = { { d_C, 2 * n * sizeof(float), C.data() } };
+
+		for (size_t l=0 ; l<locals.size() ; l++)
+		{
+			// A cos and a sin per work-item; each counted as one operation
+			size_t global = (locals[l] == 0) ? n : roundUp(n, locals[l]);
+			Launch launch = { "vecadd", n, 1, { global, 1 }, { locals[l], 1 }, 16.0 * n, 2.0 * n };
+			if (!localSizeFits(rt, kernel, launch.local, 1))
+				continue;
+			Result r = timeLaunch(cmdQueue, kernel, launch, writes, reads, warmup, reps);
+			for (size_t i=0 ; i<n ; i++)
+				if ((fabs(C[2*i] - cos(A[i])) > 1.0e-5) || (fabs(C[2*i+1] - sin(B[i])) > 1.0e-5))
+					r.ok = false;
+			results.push_back(r);
+		}
+	}
+}
+
+// saxpy (T = float) or daxpy (T = double)
+template <typename T>
+void benchAxpy(OpenCLRuntime& rt, cl_command_queue cmdQueue, const char* source, const char* name,
+	const std::vector<size_t>& sizes, const std::vector<size_t>& locals, int warmup, int reps,
+	std::vector<Result>& results)
+{
+	cl_kernel kernel = rt.kernel(source, name);
+	T a = 2.5;
+	// Device results may be fused multiply-adds; allow for the one rounding difference
+	double tolerance = (sizeof(T) == sizeof(float)) ? 1.0e-6 : 1.0e-15;
+	for (size_t s=0 ; s<sizes.size() ; s++)
+	{
+		size_t n = sizes[s];
+		std::vector<T> X(n), Y(n), Z(n);
+		for (size_t i=0 ; i<n ; i++)
+		{
+			X[i] = (i % 1000) * 0.125;
+			Y[i] = 10.0 + (i % 7);
+		}
+		MemHandle d_X = rt.createBuffer(CL_MEM_READ_ONLY, n * sizeof(T));
+		MemHandle d_Y = rt.createBuffer(CL_MEM_READ_ONLY, n * sizeof(T));
+		MemHandle d_Z = rt.createBuffer(CL_MEM_WRITE_ONLY, n * sizeof(T));
+		int iN = n;
+		cl_int status = clSetKernelArg(kernel, 0, sizeof(T), &a);
+		status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_X.get());
+		status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_Y.get());
+		status |= clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		status |= clSetKernelArg(kernel, 4, sizeof(cl_mem), &d_Z.get());
+		checkStatus(std::string("clSetKernelArg-") + name, status, true);
+		std::vector<Transfer> writes = { { d_X, n * sizeof(T), X.data() }, { d_Y, n * sizeof(T), Y.data() } };
+		std::vector<Transfer> reads = { { d_Z, n * sizeof(T), Z.data() } };
+
+		for (size_t l=0 ; l<locals.size() ; l++)
+		{
+			size_t global = (locals[l] == 0) ? n : roundUp(n, locals[l]);
+			Launch launch = { name, n, 1, { global, 1 }, { locals[l], 1 }, 3.0 * n * sizeof(T), 2.0 * n };
+			if (!localSizeFits(rt, kernel, launch.local, 1))
+				continue;
+			Result r = timeLaunch(cmdQueue, kernel, launch, writes, reads, warmup, reps);
+			for (size_t i=0 ; i<n ; i++)
+			{
+				double expected = a * X[i] + Y[i];
+				if (fabs(Z[i] - expected) > tolerance * fabs(expected))
+					r.ok = false;
+			}
+			results.push_back(r);
+		}
+	}
+}
+
+void benchMatrixMultiply(OpenCLRuntime& rt, cl_command_queue cmdQueue, const std::vector<size_t>& sizes,
+	const std::vector<size_t>& edges, int warmup, int reps, std::vector<Result>& results)
+{
+	cl_kernel kernel = rt.kernel(matrixMultiplySource, "matrixMultiply");
+	for (size_t s=0 ; s<sizes.size() ; s++)
+	{
+		size_t N = sizes[s];
+		std::vector<double> A(N*N), B(N*N), C(N*N);
+		for (size_t i=0 ; i<N*N ; i++)
+		{
+			A[i] = (i % 17) * 0.5;
+			B[i] = (i % 13) * 0.25;
+		}
+		size_t bytes = N * N * sizeof(double);
+		MemHandle d_A = rt.createBuffer(CL_MEM_READ_ONLY, bytes);
+		MemHandle d_B = rt.createBuffer(CL_MEM_READ_ONLY, bytes);
+		MemHandle d_C = rt.createBuffer(CL_MEM_WRITE_ONLY, bytes);
+		int iN = N;
+		cl_int status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+		status |= clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+		status |= clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+		status |= clSetKernelArg(kernel, 3, sizeof(int), &iN);
+		checkStatus("clSetKernelArg-matrixMultiply", status, true);
+		std::vector<Transfer> writes = { { d_A, bytes, A.data() }, { d_B, bytes, B.data() } };
+		std::vector<Transfer> reads = { { d_C, bytes, C.data() } };
+
+		for (size_t e=0 ; e<edges.size() ; e++)
+		{
+			size_t edge = edges[e];
+			size_t global = (edge == 0) ? N : roundUp(N, edge);
+			Launch launch = { "matrixMultiply", N, 2, { global, global }, { edge, edge },
+				3.0 * bytes, 2.0 * N * N * N };
+			if (!localSizeFits(rt, kernel, launch.local, 2))
+				continue;
+			Result r = timeLaunch(cmdQueue, kernel, launch, writes, reads, warmup, reps);
+			// Spot-check one row and one column of C
+			for (size_t i=0 ; i<N ; i++)
+			{
+				size_t cells[] = { (N/2)*N + i, i*N + (N/3) };
+				for (size_t c=0 ; c<2 ; c++)
+				{
+					size_t row = cells[c] / N, col = cells[c] % N;
+					double expected = 0.0;
+					for (size_t k=0 ; k<N ; k++)
+						expected += A[row*N + k] * B[k*N + col];
+					if (fabs(C[cells[c]] - expected) > 1.0e-12 * N * fabs(expected))
+						r.ok = false;
+				}
+			}
+			results.push_back(r);
+		}
+	}
+}
+
+std::string jsonString(const std::string& s)
+{
+	std::string out = "\"";
+	for (size_t i=0 ; i<s.length() ; i++)
+	{
+		if ((s[i] == '"') || (s[i] == '\\'))
+			out += '\\';
+		if (static_cast<unsigned char>(s[i]) >= ' ')
+			out += s[i];
+	}
+	return out + '"';
+}
+
+void writeTiming(std::ostream& os, const char* name, const TimingSummary& t)
+{
+	os << jsonString(name) << ": { \"min\": " << t.min << ", \"median\": " << t.median
+	   << ", \"p99\": " << t.p99 << ", \"mean\": " << t.mean << " }";
+}
+
+// amount / 1e6 per millisecond, or null when the time is too short to
+// measure (JSON has no inf or nan)
+void writeRate(std::ostream& os, double amount, double ms)
+{
+	if (ms > 0.0)
+		os << amount / (ms * 1.0e6);
+	else
+		os << "null";
+}
+
+void writeJSON(std::ostream& os, OpenCLRuntime& rt, int warmup, int reps, const std::vector<Result>& results)
+{
+	os << std::setprecision(6);
+	os << "{\n";
+	os << "  \"device\": " << jsonString(getDeviceString(rt.device(), CL_DEVICE_NAME)) << ",\n";
+	os << "  \"driver\": " << jsonString(getDeviceString(rt.device(), CL_DRIVER_VERSION)) << ",\n";
+	os << "  \"warmup\": " << warmup << ",\n";
+	os << "  \"reps\": " << reps << ",\n";
+	os << "  \"results\": [";
+	for (size_t i=0 ; i<results.size() ; i++)
+	{
+		const Result& r = results[i];
+		const Launch& l = r.launch;
+		os << ((i == 0) ? "\n" : ",\n");
+		os << "    { \"kernel\": " << jsonString(l.kernelName) << ", \"size\": " << l.size;
+		if (l.dims == 1)
+			os << ", \"global\": [" << l.global[0] << "], \"local\": [" << l.local[0] << "]";
+		else
+			os << ", \"global\": [" << l.global[0] << ", " << l.global[1] << "], \"local\": ["
+			   << l.local[0] << ", " << l.local[1] << "]";
+		os << ",\n      ";
+		writeTiming(os, "kernelMs", r.kernelMs);
+		os << ",\n      ";
+		writeTiming(os, "writeMs", r.writeMs);
+		os << ",\n      ";
+		writeTiming(os, "readMs", r.readMs);
+		// Throughputs use the median kernel time
+		os << ",\n      \"GBps\": ";
+		writeRate(os, l.bytes, r.kernelMs.median);
+		os << ", \"GFLOPs\": ";
+		writeRate(os, l.flops, r.kernelMs.median);
+		os << ", \"ok\": " << (r.ok ? "true" : "false") << " }";
+	}
+	os << "\n  ]\n}\n";
+}
+
+void printTable(const std::vector<Result>& results)
+{
+	std::cout << std::setw(15) << "kernel" << std::setw(10) << "size" << std::setw(10) << "local"
+	          << std::setw(13) << "median ms" << std::setw(11) << "p99 ms" << std::setw(11) << "write ms"
+	          << std::setw(11) << "read ms" << std::setw(9) << "GB/s" << std::setw(10) << "GFLOP/s" << '\n';
+	for (size_t i=0 ; i<results.size() ; i++)
+	{
+		const Result& r = results[i];
+		const Launch& l = r.launch;
+		std::ostringstream local;
+		if (l.local[0] == 0)
+			local << "auto";
+		else if (l.dims == 1)
+			local << l.local[0];
+		else
+			local << l.local[0] << 'x' << l.local[1];
+		std::cout << std::setw(15) << l.kernelName << std::setw(10) << l.size << std::setw(10) << local.str()
+		          << std::setw(13) << r.kernelMs.median << std::setw(11) << r.kernelMs.p99
+		          << std::setw(11) << r.writeMs.median << std::setw(11) << r.readMs.median
+		          << std::setw(9) << l.bytes / (r.kernelMs.median * 1.0e6)
+		          << std::setw(10) << l.flops / (r.kernelMs.median * 1.0e6)
+		          << (r.ok ? "" : "  WRONG RESULTS") << '\n';
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	std::vector<size_t> sizes = { 1 << 16, 1 << 20, 1 << 24 };
+	std::vector<size_t> matrixSizes = { 128, 256, 512 };
+	std::vector<size_t> locals = { 0, 64, 128, 256 };
+	std::vector<size_t> edges = { 0, 8, 16 };
+	std::string kernels = "vecadd,saxpy,daxpy,matrixMultiply";
+	std::string jsonFile = "kernelBench.json";
+	int warmup = 3, reps = 20;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (strcmp("-debug", argv[i]) == 0)
+			debug = true;
+		else if (strncmp("-kernels=", argv[i], 9) == 0)
+			kernels = argv[i]+9;
+		else if (strncmp("-sizes=", argv[i], 7) == 0)
+			sizes = parseList(argv[i]+7);
+		else if (strncmp("-msizes=", argv[i], 8) == 0)
+			matrixSizes = parseList(argv[i]+8);
+		else if (strncmp("-local=", argv[i], 7) == 0)
+			locals = parseList(argv[i]+7);
+		else if (strncmp("-local2d=", argv[i], 9) == 0)
+			edges = parseList(argv[i]+9);
+		else if (strncmp("-warmup=", argv[i], 8) == 0)
+			warmup = atoi(argv[i]+8);
+		else if (strncmp("-reps=", argv[i], 6) == 0)
+			reps = atoi(argv[i]+6);
+		else if (strncmp("-json=", argv[i], 6) == 0)
+			jsonFile = argv[i]+6;
+		else if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+				case 'a':
+					devType = CL_DEVICE_TYPE_ALL;
+					break;
+				case 'c':
+					devType = CL_DEVICE_TYPE_CPU;
+					break;
+				case 'g':
+					devType = CL_DEVICE_TYPE_GPU;
+					break;
+			}
+		}
+	}
+	if ((warmup < 0) || (reps < 1))
+	{
+		std::cerr << "Need warmup >= 0 and reps >= 1.\n";
+		return 1;
+	}
+
+	OpenCLRuntime* rt = OpenCLRuntime::get(devType);
+	if (rt == nullptr)
+	{
+		std::cerr << "No OpenCL device to run the kernels on; nothing was measured\n";
+		return 1;
+	}
+	std::cout << "Device: " << getDeviceString(rt->device(), CL_DEVICE_NAME) << "\n\n";
+	QueueHandle cmdQueue = rt->createQueue(CL_QUEUE_PROFILING_ENABLE);
+
+	std::vector<Result> results;
+	std::string list = "," + kernels + ",";
+	if (list.find(",vecadd,") != std::string::npos)
+		benchVecadd(*rt, cmdQueue, sizes, locals, warmup, reps, results);
+	if (list.find(",saxpy,") != std::string::npos)
+		benchAxpy<float>(*rt, cmdQueue, saxpySource, "saxpy", sizes, locals, warmup, reps, results);
+	bool fp64 = deviceSupportsFP64(rt->device());
+	if ((list.find(",daxpy,") != std::string::npos) && fp64)
+		benchAxpy<double>(*rt, cmdQueue, daxpySource, "daxpy", sizes, locals, warmup, reps, results);
+	if ((list.find(",matrixMultiply,") != std::string::npos) && fp64)
+		benchMatrixMultiply(*rt, cmdQueue, matrixSizes, edges, warmup, reps, results);
+	if (!fp64)
+		std::cout << "(No double precision on this device; skipping daxpy and matrixMultiply)\n";
+
+	printTable(results);
+	std::ofstream json(jsonFile.c_str());
+	writeJSON(json, *rt, warmup, reps, results);
+	json.close();
+	if (!json.good())
+	{
+		std::cerr << "\nCould not write " << jsonFile << '\n';
+		return 1;
+	}
+	std::cout << "\nWrote " << jsonFile << '\n';
+
+	for (size_t i=0 ; i<results.size() ; i++)
+		if (!results[i].ok)
+			return 1;
+	return 0;
+}
@@ -0,0 +1,193 @@
+// launchLatency.c++: Per-call latency of a small saxpy, comparing
+//  1) "legacy": the way the examples used to launch kernels, creating a
+//     context, command queue, program, kernel, and buffers on every call;
+//  2) "runtime": launching through the process-wide OpenCLRuntime, which
+//     creates the context, queue, program, and kernel only once.
+// Each call includes the host->device writes, the kernel, and the blocking
+// read of the result, so both modes do the same useful work.
+//
+// Usage: launchLatency [-a|-c|-g] [-n=<elements>] [-calls=<count>] [-legacyCalls=<count>]
+
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "OpenCLRuntime.h"
+
+static const char* saxpySource = "../ex 3/saxpy.cl";
+
+void legacyLaunch(cl_device_id dev, const char* source, float a, float* h_X, float* h_Y, size_t n, float* h_Z)
+{
+	cl_int status;
+	cl_context context = clCreateContext(nullptr, 1, &dev, nullptr, nullptr, &status);
+	checkStatus("clCreateContext", status, true);
+	cl_command_queue cmdQueue = clCreateCommandQueue(context, dev, 0, &status);
+	checkStatus("clCreateCommandQueue", status, true);
+
+	size_t datasize = n * sizeof(float);
+	cl_mem bufferX = clCreateBuffer(context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
+	checkStatus("clCreateBuffer-X", status, true);
+	cl_mem bufferY = clCreateBuffer(context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
+	checkStatus("clCreateBuffer-Y", status, true);
+	cl_mem bufferZ = clCreateBuffer(context, CL_MEM_WRITE_ONLY, datasize, nullptr, &status);
+	checkStatus("clCreateBuffer-Z", status, true);
+
+	status = clEnqueueWriteBuffer(cmdQueue, bufferX, CL_FALSE, 0, datasize, h_X, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+	status = clEnqueueWriteBuffer(cmdQueue, bufferY, CL_FALSE, 0, datasize, h_Y, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+
+	const char* programSource[] = { source };
+	cl_program program = clCreateProgramWithSource(context, 1, programSource, nullptr, &status);
+	checkStatus("clCreateProgramWithSource", status, true);
+	status = clBuildProgram(program, 1, &dev, nullptr, nullptr, nullptr);
+	checkStatus("clBuildProgram", status, true);
+	cl_kernel kernel = clCreateKernel(program, "saxpy", &status);
+	checkStatus("clCreateKernel", status, true);
+
+	int iN = n;
+	clSetKernelArg(kernel, 0, sizeof(float), &a);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufferX);
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufferY);
+	clSetKernelArg(kernel, 3, sizeof(int), &iN);
+	clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferZ);
+
+	size_t globalWorkSize[] = { n };
+	status = clEnqueueNDRangeKernel(cmdQueue, kernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+	status = clEnqueueReadBuffer(cmdQueue, bufferZ, CL_TRUE, 0, datasize, h_Z, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+
+	clReleaseKernel(kernel);
+	clReleaseProgram(program);
+	clReleaseCommandQueue(cmdQueue);
+	clReleaseMemObject(bufferX);
+	clReleaseMemObject(bufferY);
+	clReleaseMemObject(bufferZ);
+	clReleaseContext(context);
+}
+
+void runtimeLaunch(OpenCLRuntime& rt, float a, float* h_X, float* h_Y, size_t n, float* h_Z)
+{
+	cl_command_queue cmdQueue = rt.queue();
+	size_t datasize = n * sizeof(float);
+	MemHandle bufferX = rt.createBuffer(CL_MEM_READ_ONLY, datasize);
+	MemHandle bufferY = rt.createBuffer(CL_MEM_READ_ONLY, datasize);
+	MemHandle bufferZ = rt.createBuffer(CL_MEM_WRITE_ONLY, datasize);
+
+	cl_int status = clEnqueueWriteBuffer(cmdQueue, bufferX, CL_FALSE, 0, datasize, h_X, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+	status = clEnqueueWriteBuffer(cmdQueue, bufferY, CL_FALSE, 0, datasize, h_Y, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+
+	cl_kernel kernel = rt.kernel(saxpySource, "saxpy");
+	int iN = n;
+	clSetKernelArg(kernel, 0, sizeof(float), &a);
+	clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufferX.get());
+	clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufferY.get());
+	clSetKernelArg(kernel, 3, sizeof(int), &iN);
+	clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferZ.get());
+
+	size_t globalWorkSize[] = { n };
+	status = clEnqueueNDRangeKernel(cmdQueue, kernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+	status = clEnqueueReadBuffer(cmdQueue, bufferZ, CL_TRUE, 0, datasize, h_Z, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+}
+
+// Prints the mean, median, and 99th percentile of the per-call times (in microseconds)
+void report(const std::string& label, std::vector<double>& usec)
+{
+	std::sort(usec.begin(), usec.end());
+	double sum = 0.0;
+	for (size_t i=0 ; i<usec.size() ; i++)
+		sum += usec[i];
+	std::cout << label << ": " << usec.size() << " calls, mean = " << (sum / usec.size())
+	          << " us, median = " << usec[usec.size()/2]
+	          << " us, p99 = " << usec[(usec.size()*99)/100] << " us\n";
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	size_t n = 1024;
+	int nCalls = 1000;
+	int nLegacyCalls = 20; // each of these compiles saxpy.cl from scratch
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (strcmp("-debug", argv[i]) == 0)
+			debug = true;
+		else if (strncmp("-n=", argv[i], 3) == 0)
+			n = atol(argv[i]+3);
+		else if (strncmp("-calls=", argv[i], 7) == 0)
+			nCalls = atoi(argv[i]+7);
+		else if (strncmp("-legacyCalls=", argv[i], 13) == 0)
+			nLegacyCalls = atoi(argv[i]+13);
+		else if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+				case 'a':
+					devType = CL_DEVICE_TYPE_ALL;
+					break;
+				case 'c':
+					devType = CL_DEVICE_TYPE_CPU;
+					break;
+				case 'g':
+					devType = CL_DEVICE_TYPE_GPU;
+					break;
+			}
+		}
+	}
+	if ((n < 1) || (nCalls < 1) || (nLegacyCalls < 1))
+	{
+		std::cerr << "Sizes and call counts must be positive.\n";
+		return 1;
+	}
+
+	OpenCLRuntime* rt = OpenCLRuntime::get(devType);
+	if (rt == nullptr)
+		return 0;
+
+	std::vector<float> X(n, 1000.0f), Y(n, 10.0f), Z(n);
+	float a = 2.0f;
+	const char* source = readSource(saxpySource);
+
+	// One untimed call of each, so that neither pays for first-use costs
+	// (e.g., loading the compiler) in its statistics.
+	legacyLaunch(rt->device(), source, a, X.data(), Y.data(), n, Z.data());
+	runtimeLaunch(*rt, a, X.data(), Y.data(), n, Z.data());
+
+	std::vector<double> legacyTimes, runtimeTimes;
+	for (int i=0 ; i<nLegacyCalls ; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		legacyLaunch(rt->device(), source, a, X.data(), Y.data(), n, Z.data());
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		legacyTimes.push_back(elapsed.count());
+	}
+	for (int i=0 ; i<nCalls ; i++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		runtimeLaunch(*rt, a, X.data(), Y.data(), n, Z.data());
+		std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		runtimeTimes.push_back(elapsed.count());
+	}
+
+	int nBad = 0;
+	for (size_t i=0 ; i<n ; i++)
+		if (Z[i] != a * X[i] + Y[i])
+			nBad++;
+	if (nBad != 0)
+		std::cout << "WARNING: " << nBad << " of " << n << " results are wrong\n";
+
+	std::cout << "saxpy, n = " << n << '\n';
+	report("legacy (per-call setup)", legacyTimes);
+	report("runtime (shared setup) ", runtimeTimes);
+	free(const_cast<char*>(source));
+
+	return (nBad == 0) ? 0 : 1;
+}
@@ -0,0 +1,146 @@
+// programCache.c++: Cold vs. warm program build times.
+//
+// "Cold" builds each example's program from source, as on the very first
+// run (its cache entry is invalidated first, so the build also pays for
+// storing the new binary). "Warm" builds the same program again, which
+// now loads the binary from the on-disk cache. See common/ProgramCache.h
+// for where the cache lives and how to disable it.
+//
+// Usage: programCache [-a|-c|-g] [-cold|-warm] [-reps=<count>] [-clear]
+//   -cold, -warm: time only that mode (default: both)
+//   -clear: remove every entry from the cache, then exit
+
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "OpenCLRuntime.h"
+#include "ProgramCache.h"
+
+struct ProgramSpec
+{
+	const char* fileName;
+	const char* options;
+	bool needsFP64;
+};
+
+static const ProgramSpec programSpecs[] =
+{
+	{ "../ex 1/SimpleOpenCL.cl", "", false },
+	{ "../ex 2/HelloOpenCL.cl", "", false },
+	{ "../ex 3/saxpy.cl", "", false },
+	{ "../ex 3/daxpy.cl", "", true },
+	{ "../ex 4/matrixMultiplyV1.cl", "", true },
+	{ "../ex 4/matrixMultiplyV2.cl", "-DTILE_SIZE=16", true },
+	{ "../ex 4/matrixMultiplyV3.cl", "-DTILE_SIZE=32 -DWPT=4", true },
+};
+
+// Best-of-"nReps" time (in milliseconds) to build the program, invalidating
+// its cache entry before each build if "cold".
+double timeBuild(OpenCLRuntime& rt, const std::string& source, const std::string& options,
+	bool cold, int nReps, bool& allHits)
+{
+	double best = -1.0;
+	allHits = true;
+	for (int rep=0 ; rep<nReps ; rep++)
+	{
+		if (cold)
+			invalidateCachedProgram(rt.device(), source, options);
+		bool hit;
+		auto start = std::chrono::steady_clock::now();
+		ProgramHandle pgm = buildProgramCached(rt.context(), rt.device(), source, options, &hit);
+		std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+		allHits = allHits && hit;
+		if ((best < 0.0) || (elapsed.count() < best))
+			best = elapsed.count();
+	}
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	bool runCold = true, runWarm = true;
+	int nReps = 3;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (strcmp("-debug", argv[i]) == 0)
+			debug = true;
+		else if (strcmp("-clear", argv[i]) == 0)
+		{
+			std::cout << "Removed " << clearProgramCache() << " entries from "
+			          << programCacheDirectory() << '\n';
+			return 0;
+		}
+		else if (strcmp("-cold", argv[i]) == 0)
+			runWarm = false;
+		else if (strcmp("-warm", argv[i]) == 0)
+			runCold = false;
+		else if (strncmp("-reps=", argv[i], 6) == 0)
+			nReps = std::max(1, atoi(argv[i]+6));
+		else if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+				case 'a':
+					devType = CL_DEVICE_TYPE_ALL;
+					break;
+				case 'c':
+					devType = CL_DEVICE_TYPE_CPU;
+					break;
+				case 'g':
+					devType = CL_DEVICE_TYPE_GPU;
+					break;
+			}
+		}
+	}
+	if (programCacheDirectory().empty())
+	{
+		std::cerr << "The program cache is disabled (see GPGPU_PROGRAM_CACHE).\n";
+		return 1;
+	}
+
+	OpenCLRuntime* rt = OpenCLRuntime::get(devType);
+	if (rt == nullptr)
+		return 0;
+	bool haveFP64 = deviceSupportsFP64(rt->device());
+	std::cout << "Device: " << getDeviceString(rt->device(), CL_DEVICE_NAME)
+	          << "\nCache:  " << programCacheDirectory() << "\n\n";
+
+	double totalCold = 0.0, totalWarm = 0.0;
+	for (size_t i=0 ; i<sizeof(programSpecs)/sizeof(programSpecs[0]) ; i++)
+	{
+		const ProgramSpec& spec = programSpecs[i];
+		if (spec.needsFP64 && !haveFP64)
+			continue;
+		const char* text = readSource(spec.fileName);
+		std::string source(text);
+		free(const_cast<char*>(text));
+
+		std::cout << spec.fileName << ' ' << spec.options << ":";
+		if (runCold)
+		{
+			bool hits;
+			double ms = timeBuild(*rt, source, spec.options, true, nReps, hits);
+			totalCold += ms;
+			std::cout << "  cold " << ms << " ms";
+		}
+		if (runWarm)
+		{
+			bool hits;
+			double ms = timeBuild(*rt, source, spec.options, false, nReps, hits);
+			totalWarm += ms;
+			std::cout << "  warm " << ms << " ms" << (hits ? "" : " (not all from cache)");
+		}
+		std::cout << '\n';
+	}
+	if (runCold)
+		std::cout << "\nTotal cold: " << totalCold << " ms\n";
+	if (runWarm)
+		std::cout << (runCold ? "" : "\n") << "Total warm: " << totalWarm << " ms\n";
+
+	return 0;
+}
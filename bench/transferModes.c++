@@ -0,0 +1,230 @@
+// transferModes.c++: saxpy per-call time with three ways of moving data:
+//  copy:     new device buffers every call, clEnqueueWriteBuffer/ReadBuffer
+//  pooled:   device buffers reused from the runtime's BufferPool, same copies
+//  zerocopy: host arrays are HostArrays (CL_MEM_ALLOC_HOST_PTR); each call
+//            runs the kernel on them in place and maps the result to read it
+// for vector sizes from 1K to 256M elements (by factors of 4), or until a
+// size no longer fits the device or the host's memory. Each call includes
+// everything needed to get the result into host memory.
+//
+// Usage: transferModes [-a|-c|-g] [-min=<elements>] [-max=<elements>]
+
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <unistd.h>
+
+#include "OpenCLRuntime.h"
+#include "HostArray.h"
+
+static const char* saxpySource = "../ex 3/saxpy.cl";
+
+enum TransferMode { COPY, POOLED, ZERO_COPY };
+static const char* modeNames[] = { "copy", "pooled", "zerocopy" };
+
+void enqueueSaxpy(OpenCLRuntime& rt, float a, cl_mem d_X, cl_mem d_Y, size_t n, cl_mem d_Z)
+{
+	cl_kernel kernel = rt.kernel(saxpySource, "saxpy");
+	int iN = n;
+	cl_int status = clSetKernelArg(kernel, 0, sizeof(float), &a);
+	checkStatus("clSetKernelArg-0", status, true);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_X);
+	checkStatus("clSetKernelArg-1", status, true);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_Y);
+	checkStatus("clSetKernelArg-2", status, true);
+	status = clSetKernelArg(kernel, 3, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-3", status, true);
+	status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &d_Z);
+	checkStatus("clSetKernelArg-4", status, true);
+	size_t globalWorkSize[] = { n };
+	status = clEnqueueNDRangeKernel(rt.queue(), kernel, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, nullptr);
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+}
+
+void copyLaunch(OpenCLRuntime& rt, bool pooled, float a, const float* h_X, const float* h_Y, size_t n, float* h_Z)
+{
+	size_t datasize = n * sizeof(float);
+	MemHandle bufferX, bufferY, bufferZ;
+	PooledBuffer pooledX, pooledY, pooledZ;
+	if (pooled)
+	{
+		pooledX = rt.acquireBuffer(datasize);
+		pooledY = rt.acquireBuffer(datasize);
+		pooledZ = rt.acquireBuffer(datasize);
+	}
+	else
+	{
+		bufferX = rt.createBuffer(CL_MEM_READ_ONLY, datasize);
+		bufferY = rt.createBuffer(CL_MEM_READ_ONLY, datasize);
+		bufferZ = rt.createBuffer(CL_MEM_WRITE_ONLY, datasize);
+	}
+	cl_mem d_X = pooled ? pooledX.get() : bufferX.get();
+	cl_mem d_Y = pooled ? pooledY.get() : bufferY.get();
+	cl_mem d_Z = pooled ? pooledZ.get() : bufferZ.get();
+
+	cl_int status = clEnqueueWriteBuffer(rt.queue(), d_X, CL_FALSE, 0, datasize, h_X, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+	status = clEnqueueWriteBuffer(rt.queue(), d_Y, CL_FALSE, 0, datasize, h_Y, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+	enqueueSaxpy(rt, a, d_X, d_Y, n, d_Z);
+	status = clEnqueueReadBuffer(rt.queue(), d_Z, CL_TRUE, 0, datasize, h_Z, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+}
+
+// The host's physical memory, or 0 if the system does not say
+cl_ulong hostMemory()
+{
+	long pages = sysconf(_SC_PHYS_PAGES);
+	long pageSize = sysconf(_SC_PAGESIZE);
+	return ((pages > 0) && (pageSize > 0)) ? static_cast<cl_ulong>(pages) * pageSize : 0;
+}
+
+// Returns the number of wrong results
+int check(float a, const float* X, const float* Y, size_t n, const float* Z)
+{
+	int nBad = 0;
+	for (size_t i=0 ; i<n ; i++)
+		if (Z[i] != a * X[i] + Y[i])
+			nBad++;
+	return nBad;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	size_t minN = 1 << 10, maxN = 1 << 28;
+	for (int i=1 ; i<argc ; i++)
+	{
+		if (strcmp("-debug", argv[i]) == 0)
+			debug = true;
+		else if (strncmp("-min=", argv[i], 5) == 0)
+			minN = atol(argv[i]+5);
+		else if (strncmp("-max=", argv[i], 5) == 0)
+			maxN = atol(argv[i]+5);
+		else if (argv[i][0] == '-')
+		{
+			switch (argv[i][1])
+			{
+				case 'a':
+					devType = CL_DEVICE_TYPE_ALL;
+					break;
+				case 'c':
+					devType = CL_DEVICE_TYPE_CPU;
+					break;
+				case 'g':
+					devType = CL_DEVICE_TYPE_GPU;
+					break;
+			}
+		}
+	}
+
+	OpenCLRuntime* rt = OpenCLRuntime::get(devType);
+	if (rt == nullptr)
+		return 0;
+	cl_ulong maxAlloc, globalMem;
+	cl_device_type type;
+	clGetDeviceInfo(rt->device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, nullptr);
+	clGetDeviceInfo(rt->device(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, nullptr);
+	clGetDeviceInfo(rt->device(), CL_DEVICE_TYPE, sizeof(cl_device_type), &type, nullptr);
+	cl_ulong hostMem = hostMemory();
+	std::cout << "Device: " << getDeviceString(rt->device(), CL_DEVICE_NAME) << "\n\n";
+	std::cout << "         n     mode   median ms     GB/s  buffersCreated  poolHits  maps\n";
+
+	float a = 2.0f;
+	int nBad = 0;
+	for (size_t n=std::max<size_t>(minN, 1) ; n<=maxN ; n*=4)
+	{
+		size_t datasize = n * sizeof(float);
+		// Pooled buffers may be up to 25% larger than requested
+		if ((BufferPool::bucketSize(datasize) > maxAlloc) || (3 * BufferPool::bucketSize(datasize) > globalMem))
+		{
+			std::cout << n << ": too large for this device; stopping\n";
+			break;
+		}
+		// The host holds X, Y, and Z and the three HostArrays at once; on a
+		// CPU device the three device buffers are host memory too. Leave
+		// half of it for everything else.
+		cl_ulong hostBytes = 6 * static_cast<cl_ulong>(datasize);
+		if ((type & CL_DEVICE_TYPE_CPU) != 0)
+			hostBytes += 3 * BufferPool::bucketSize(datasize);
+		if ((hostMem != 0) && (hostBytes > hostMem / 2))
+		{
+			std::cout << n << ": too large for this host's memory; stopping\n";
+			break;
+		}
+		// The pool keeps at most maxIdleBytes of idle buffers; let it hold
+		// all three of this size's, or "pooled" would allocate every call
+		// once they pass the default cap (1 GiB).
+		rt->bufferPool().setMaxIdleBytes(std::max<size_t>(static_cast<size_t>(1) << 30,
+			3 * BufferPool::bucketSize(datasize)));
+		// Enough calls to get a stable median, without taking all day
+		int nCalls = static_cast<int>(std::max<size_t>(5, std::min<size_t>(200, (size_t(1) << 26) / n)));
+
+		std::vector<float> X(n), Y(n), Z(n);
+		for (size_t i=0 ; i<n ; i++)
+		{
+			X[i] = static_cast<float>(i % 1000);
+			Y[i] = 10.0f;
+		}
+		HostArray<float> hX(*rt, n), hY(*rt, n), hZ(*rt, n);
+		std::copy(X.begin(), X.end(), hX.map(CL_MAP_WRITE));
+		std::copy(Y.begin(), Y.end(), hY.map(CL_MAP_WRITE));
+		hX.unmap();
+		hY.unmap();
+
+		for (int m=COPY ; m<=ZERO_COPY ; m++)
+		{
+			TransferMode mode = static_cast<TransferMode>(m);
+			// One untimed call so first-use costs (and, for "pooled", the
+			// first allocation) do not land in the statistics.
+			if (mode == ZERO_COPY)
+			{
+				enqueueSaxpy(*rt, a, hX.buffer(), hY.buffer(), n, hZ.buffer());
+				hZ.map(CL_MAP_READ);
+				hZ.unmap();
+			}
+			else
+				copyLaunch(*rt, mode == POOLED, a, X.data(), Y.data(), n, Z.data());
+
+			AllocationCounters before = allocationCounters;
+			std::vector<double> ms;
+			for (int call=0 ; call<nCalls ; call++)
+			{
+				auto start = std::chrono::steady_clock::now();
+				if (mode == ZERO_COPY)
+				{
+					enqueueSaxpy(*rt, a, hX.buffer(), hY.buffer(), n, hZ.buffer());
+					hZ.map(CL_MAP_READ);
+				}
+				else
+					copyLaunch(*rt, mode == POOLED, a, X.data(), Y.data(), n, Z.data());
+				std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+				ms.push_back(elapsed.count());
+				if (call == nCalls-1)
+					nBad += check(a, X.data(), Y.data(), n, (mode == ZERO_COPY) ? hZ.data() : Z.data());
+				if (mode == ZERO_COPY)
+					hZ.unmap();
+			}
+			std::sort(ms.begin(), ms.end());
+			double median = ms[ms.size()/2];
+			// saxpy moves 3 arrays' worth of data (read X and Y, write Z)
+			double gbs = 3.0 * datasize / (median * 1.0e-3) * 1.0e-9;
+			std::cout.width(10); std::cout << n << ' ';
+			std::cout.width(8); std::cout << modeNames[mode] << ' ';
+			std::cout.width(11); std::cout << median << ' ';
+			std::cout.width(8); std::cout << gbs << ' ';
+			std::cout.width(15); std::cout << (allocationCounters.buffersCreated - before.buffersCreated) << ' ';
+			std::cout.width(9); std::cout << (allocationCounters.poolHits - before.poolHits) << ' ';
+			std::cout.width(5); std::cout << (allocationCounters.mapCalls - before.mapCalls) << '\n';
+		}
+		// Don't let idle buffers from this size crowd out the next one
+		rt->bufferPool().trim();
+	}
+	if (nBad != 0)
+		std::cout << "WARNING: " << nBad << " wrong results\n";
+
+	return (nBad == 0) ? 0 : 1;
+}
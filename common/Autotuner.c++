@@ -0,0 +1,258 @@
+// Autotuner.c++: Find, and remember, the fastest way to launch a kernel.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "Autotuner.h"
+#include "OpenCLRuntime.h"
+#include "ProgramCache.h"
+
+struct TunedEntry
+{
+	LaunchConfig config;
+	double seconds;
+};
+
+// Keyed by device + '\t' + kernelKey + '\t' + bucket, i.e., the first
+// three fields of the line in the tuning file.
+typedef std::map<std::string, TunedEntry> TuningTable;
+
+std::string tuningFilePath()
+{
+	const char* path = getenv("GPGPU_TUNING_FILE");
+	if (path != nullptr)
+		return (strcmp(path, "off") == 0) ? "" : path;
+	std::string dir = userCacheDirectory();
+	return dir.empty() ? "" : dir + "/tuning.txt";
+}
+
+static std::string deviceKey(cl_device_id dev)
+{
+	static std::map<cl_device_id, std::string> keys;
+	std::map<cl_device_id, std::string>::iterator it = keys.find(dev);
+	if (it != keys.end())
+		return it->second;
+	std::string key = getDeviceString(dev, CL_DEVICE_NAME) + " | " + getDeviceString(dev, CL_DRIVER_VERSION);
+	for (size_t i=0 ; i<key.size() ; i++)
+		if ((key[i] == '\t') || (key[i] == '\n'))
+			key[i] = ' ';
+	keys[dev] = key;
+	return key;
+}
+
+// floor(log2(problemSize))
+static int sizeBucket(size_t problemSize)
+{
+	int bucket = 0;
+	while (problemSize > 1)
+	{
+		problemSize >>= 1;
+		bucket++;
+	}
+	return bucket;
+}
+
+static std::string entryKey(cl_device_id dev, const std::string& kernelKey, size_t problemSize)
+{
+	return deviceKey(dev) + '\t' + kernelKey + '\t' + std::to_string(sizeBucket(problemSize));
+}
+
+// Each line: device, kernelKey, bucket, dims, local[0..2], seconds, options
+// (tab-separated; options last since they may contain spaces).
+static void readTuningFile(const std::string& path, TuningTable& table)
+{
+	std::ifstream in(path.c_str());
+	std::string line;
+	while (std::getline(in, line))
+	{
+		std::vector<std::string> fields;
+		std::stringstream ss(line);
+		std::string field;
+		while ((fields.size() < 8) && std::getline(ss, field, '\t'))
+			fields.push_back(field);
+		if (fields.size() < 8)
+			continue; // not ours, or damaged
+		std::string options;
+		std::getline(ss, options);
+		TunedEntry entry;
+		entry.config = LaunchConfig(atoi(fields[3].c_str()), atol(fields[4].c_str()), atol(fields[5].c_str()),
+			atol(fields[6].c_str()), options);
+		entry.seconds = atof(fields[7].c_str());
+		if ((entry.config.dims < 1) || (entry.config.dims > 3))
+			continue;
+		table[fields[0] + '\t' + fields[1] + '\t' + fields[2]] = entry;
+	}
+}
+
+// Rewrite the whole file through a temporary file and a rename, so that
+// readers never see a partial file.
+static void writeTuningFile(const std::string& path, const TuningTable& table)
+{
+	size_t slash = path.rfind('/');
+	if ((slash != std::string::npos) && (slash > 0) && !makeDirectories(path.substr(0, slash)))
+	{
+		if (debug)
+			std::cout << "Autotuner: cannot create the directory for " << path << '\n';
+		return;
+	}
+	// Two threads of one process may save at the same time
+	static std::atomic<int> counter(0);
+	std::string tmpPath = path + ".tmp." + std::to_string(getpid()) + '.' + std::to_string(counter++);
+	{
+		std::ofstream out(tmpPath.c_str(), std::ios::trunc);
+		for (TuningTable::const_iterator it=table.begin() ; it!=table.end() ; it++)
+		{
+			const LaunchConfig& c = it->second.config;
+			out << it->first << '\t' << c.dims << '\t' << c.local[0] << '\t' << c.local[1] << '\t'
+			    << c.local[2] << '\t' << it->second.seconds << '\t' << c.options << '\n';
+		}
+		if (!out.flush())
+		{
+			out.close();
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+	if (rename(tmpPath.c_str(), path.c_str()) != 0)
+		unlink(tmpPath.c_str());
+}
+
+// The tuning file's contents, read on first use
+static TuningTable& tuningTable()
+{
+	static TuningTable table;
+	static bool loaded = false;
+	if (!loaded)
+	{
+		loaded = true;
+		std::string path = tuningFilePath();
+		if (!path.empty())
+			readTuningFile(path, table);
+	}
+	return table;
+}
+
+std::vector<LaunchConfig> candidateLocalSizes(cl_kernel kernel, cl_device_id dev, cl_uint dims)
+{
+	KernelLimits limits = getKernelLimits(kernel, dev);
+	size_t maxItems[3] = { 1, 1, 1 };
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(maxItems), maxItems, nullptr);
+	size_t maxSize = limits.maxWorkGroupSize;
+	size_t multiple = limits.preferredMultiple;
+	if ((multiple == 0) || (multiple > maxSize))
+		multiple = 1;
+
+	// Work-groups are at least "multiple" work-items, and no taller (or
+	// deeper) than they are wide, so that neighboring work-items tend to
+	// touch neighboring memory.
+	std::vector<LaunchConfig> candidates;
+	candidates.push_back(LaunchConfig(dims));
+	for (size_t x=multiple ; (x <= maxSize) && (x <= maxItems[0]) ; x*=2)
+	{
+		if (dims == 1)
+		{
+			candidates.push_back(LaunchConfig(1, x));
+			continue;
+		}
+		for (size_t y=1 ; (y <= x) && (x*y <= maxSize) && (y <= maxItems[1]) ; y*=2)
+		{
+			if (dims == 2)
+			{
+				if (x*y >= multiple)
+					candidates.push_back(LaunchConfig(2, x, y));
+				continue;
+			}
+			for (size_t z=1 ; (z <= y) && (x*y*z <= maxSize) && (z <= maxItems[2]) ; z*=2)
+				if (x*y*z >= multiple)
+					candidates.push_back(LaunchConfig(3, x, y, z));
+		}
+	}
+	return candidates;
+}
+
+size_t roundUpGlobal(size_t n, size_t local)
+{
+	if (local == 0)
+		return n;
+	return ((n + local - 1) / local) * local;
+}
+
+bool findTunedConfig(cl_device_id dev, const std::string& kernelKey, size_t problemSize,
+	LaunchConfig& config)
+{
+	TuningTable& table = tuningTable();
+	TuningTable::iterator it = table.find(entryKey(dev, kernelKey, problemSize));
+	if (it == table.end())
+		return false;
+	config = it->second.config;
+	return true;
+}
+
+static void describe(std::ostream& os, const LaunchConfig& c)
+{
+	if (c.local[0] == 0)
+		os << "local = auto";
+	else
+	{
+		os << "local = " << c.local[0];
+		for (cl_uint d=1 ; d<c.dims ; d++)
+			os << 'x' << c.local[d];
+	}
+	if (!c.options.empty())
+		os << ", " << c.options;
+}
+
+LaunchConfig autotune(cl_device_id dev, const std::string& kernelKey, size_t problemSize,
+	const std::vector<LaunchConfig>& candidates, const std::function<double(const LaunchConfig&)>& run)
+{
+	std::cout << "Autotuning " << kernelKey << " for size " << problemSize << ": "
+	          << candidates.size() << " candidates\n";
+	TunedEntry best;
+	best.seconds = -1.0;
+	for (size_t i=0 ; i<candidates.size() ; i++)
+	{
+		double seconds = run(candidates[i]);
+		if (debug)
+		{
+			std::cout << "  ";
+			describe(std::cout, candidates[i]);
+			if (seconds < 0.0)
+				std::cout << ": not usable\n";
+			else
+				std::cout << ": " << (seconds * 1.0e3) << " ms\n";
+		}
+		if ((seconds >= 0.0) && ((best.seconds < 0.0) || (seconds < best.seconds)))
+		{
+			best.config = candidates[i];
+			best.seconds = seconds;
+		}
+	}
+	if (best.seconds < 0.0)
+	{
+		std::cout << "No candidate configuration could be used\n";
+		return LaunchConfig(candidates.empty() ? 1 : candidates[0].dims);
+	}
+	std::cout << "Best: ";
+	describe(std::cout, best.config);
+	std::cout << " (" << (best.seconds * 1.0e3) << " ms)\n";
+
+	std::string key = entryKey(dev, kernelKey, problemSize);
+	tuningTable()[key] = best;
+	std::string path = tuningFilePath();
+	if (!path.empty())
+	{
+		// Merge with whatever other processes have saved since we loaded it
+		TuningTable onDisk;
+		readTuningFile(path, onDisk);
+		onDisk[key] = best;
+		writeTuningFile(path, onDisk);
+	}
+	return best.config;
+}
@@ -0,0 +1,66 @@
+// Autotuner.h: Find, and remember, the fastest way to launch a kernel.
+//
+// A launch configuration is a local work size plus, for kernels whose tile
+// sizes and the like are compiled in with "-D", a set of build options.
+// The autotuner times the candidate configurations the caller proposes
+// (candidateLocalSizes lists the local sizes a kernel can legally use),
+// keeps the fastest, and saves it in a tuning file. Later runs look the
+// configuration up instead of launching with whatever the driver guesses.
+//
+// Entries are keyed by the device (name and driver version), a kernel key
+// chosen by the caller (e.g., "saxpy.cl:saxpy"), and the problem size's
+// bucket: its power of two, since the best configuration changes with the
+// size, but slowly.
+//
+// The tuning file is $GPGPU_TUNING_FILE if that is set (set it to "off" to
+// neither read nor write one), else "tuning.txt" in the user's cache
+// directory (see ProgramCache.h). It is plain text, one entry per line.
+
+#ifndef AUTOTUNER_H
+#define AUTOTUNER_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "CLHandle.h"
+
+struct LaunchConfig
+{
+	cl_uint dims;
+	size_t local[3];     // local[0] == 0: let the implementation choose
+	std::string options; // build options, e.g., "-DTILE_SIZE=16"
+
+	LaunchConfig(cl_uint dims = 1, size_t l0 = 0, size_t l1 = 1, size_t l2 = 1, const std::string& options = "") :
+		dims(dims), options(options) { local[0] = l0; local[1] = l1; local[2] = l2; }
+	// For clEnqueueNDRangeKernel's local_work_size argument
+	const size_t* localWorkSize() const { return (local[0] == 0) ? nullptr : local; }
+};
+
+// The tuning file; empty if tuning results are not being kept.
+std::string tuningFilePath();
+
+// The local sizes "kernel" can use on "dev" in "dims" dimensions: multiples
+// of its preferred work-group size multiple, doubling up to its maximum
+// work-group size. The first candidate is always "let the implementation
+// choose".
+std::vector<LaunchConfig> candidateLocalSizes(cl_kernel kernel, cl_device_id dev, cl_uint dims);
+
+// The global size to launch "n" work-items with work-groups of "local":
+// "n" rounded up to a multiple of "local" (or "n" itself if local is 0).
+// The kernel must ignore work-items past the end.
+size_t roundUpGlobal(size_t n, size_t local);
+
+// The saved configuration for this kernel, device, and problem size, if
+// there is one.
+bool findTunedConfig(cl_device_id dev, const std::string& kernelKey, size_t problemSize,
+	LaunchConfig& config);
+
+// Times "run" (which returns seconds, or a negative value if it cannot
+// use the configuration) on each candidate, saves the fastest for this
+// kernel, device, and problem size, and returns it. If no candidate runs,
+// returns the default configuration and saves nothing.
+LaunchConfig autotune(cl_device_id dev, const std::string& kernelKey, size_t problemSize,
+	const std::vector<LaunchConfig>& candidates, const std::function<double(const LaunchConfig&)>& run);
+
+#endif
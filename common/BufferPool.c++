@@ -0,0 +1,82 @@
+// BufferPool.c++: Reuse device buffers across kernel launches.
+
+#include "BufferPool.h"
+#include "OpenCLRuntime.h"
+
+AllocationCounters allocationCounters;
+
+PooledBuffer& PooledBuffer::operator=(PooledBuffer&& b)
+{
+	if (this != &b)
+	{
+		giveBack();
+		pool = b.pool;
+		bucket = b.bucket;
+		buf = std::move(b.buf);
+		b.pool = nullptr;
+	}
+	return *this;
+}
+
+void PooledBuffer::giveBack()
+{
+	if ((pool != nullptr) && buf)
+		pool->giveBack(bucket, std::move(buf));
+	pool = nullptr;
+}
+
+size_t BufferPool::bucketSize(size_t size)
+{
+	// Nothing smaller than a page; above that, round up to the next of
+	// 4, 5, 6, 7 times a power of two.
+	const size_t minBucket = 4096;
+	if (size <= minBucket)
+		return minBucket;
+	size_t topBit = 1;
+	while ((topBit << 1) <= size)
+		topBit <<= 1;
+	size_t step = topBit / 4;
+	return ((size + step - 1) / step) * step;
+}
+
+PooledBuffer BufferPool::acquire(size_t size)
+{
+	size_t bucket = bucketSize(size);
+	std::map<size_t, std::vector<MemHandle> >::iterator it = idle.find(bucket);
+	if ((it != idle.end()) && !it->second.empty())
+	{
+		MemHandle buf(std::move(it->second.back()));
+		it->second.pop_back();
+		idleBytes -= bucket;
+		allocationCounters.poolHits++;
+		return PooledBuffer(this, bucket, std::move(buf));
+	}
+
+	cl_int status;
+	MemHandle buf(clCreateBuffer(ctx, CL_MEM_READ_WRITE, bucket, nullptr, &status));
+	if (status != CL_SUCCESS)
+	{
+		// Maybe the idle buffers are what is in the way; try once more without them
+		trim();
+		buf.reset(clCreateBuffer(ctx, CL_MEM_READ_WRITE, bucket, nullptr, &status));
+	}
+	checkStatus("clCreateBuffer-pool", status, true);
+	allocationCounters.buffersCreated++;
+	allocationCounters.bytesCreated += bucket;
+	allocationCounters.poolMisses++;
+	return PooledBuffer(this, bucket, std::move(buf));
+}
+
+void BufferPool::giveBack(size_t bucket, MemHandle buf)
+{
+	if (idleBytes + bucket > maxIdleBytes)
+		return; // "buf" is released as it goes out of scope
+	idle[bucket].push_back(std::move(buf));
+	idleBytes += bucket;
+}
+
+void BufferPool::trim()
+{
+	idle.clear();
+	idleBytes = 0;
+}
@@ -0,0 +1,97 @@
+// BufferPool.h: Reuse device buffers across kernel launches.
+//
+// Creating a cl_mem for every launch (and releasing it right after) costs
+// an allocation in the driver, and on some devices a page-table update.
+// A BufferPool keeps released buffers on a free list, grouped into size
+// buckets, and hands them out again for later requests of similar size.
+// Buckets are spaced four per power of two, so a request never gets a
+// buffer more than 25% larger than it asked for.
+//
+// All pooled buffers are CL_MEM_READ_WRITE so that any request can reuse
+// any idle buffer of the right bucket.
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <map>
+#include <vector>
+
+#include "CLHandle.h"
+
+// Process-wide counts of what the allocation paths in common/ have done.
+// Compare snapshots before and after some work to see what it cost.
+struct AllocationCounters
+{
+	size_t buffersCreated; // clCreateBuffer calls, pooled or not
+	size_t bytesCreated;
+	size_t poolHits;       // BufferPool::acquire served from the free list
+	size_t poolMisses;     // BufferPool::acquire had to create a buffer
+	size_t mapCalls;       // clEnqueueMapBuffer calls by HostArray
+
+	AllocationCounters() { reset(); }
+	void reset() { buffersCreated = bytesCreated = poolHits = poolMisses = mapCalls = 0; }
+};
+extern AllocationCounters allocationCounters;
+
+class BufferPool;
+
+// A buffer on loan from a BufferPool. It goes back to the pool (rather than
+// being released) when the PooledBuffer is destroyed.
+class PooledBuffer
+{
+public:
+	PooledBuffer() : pool(nullptr), bucket(0) {}
+	PooledBuffer(PooledBuffer&& b) noexcept : pool(b.pool), bucket(b.bucket), buf(std::move(b.buf)) { b.pool = nullptr; }
+	PooledBuffer& operator=(PooledBuffer&& b);
+	~PooledBuffer() { giveBack(); }
+
+	// Returned by reference so that "&b.get()" can be handed to clSetKernelArg.
+	const cl_mem& get() const { return buf.get(); }
+	operator cl_mem() const { return buf.get(); }
+	// The actual size of the buffer, which may exceed the size requested.
+	size_t capacity() const { return bucket; }
+
+private:
+	friend class BufferPool;
+	PooledBuffer(BufferPool* p, size_t b, MemHandle&& m) : pool(p), bucket(b), buf(std::move(m)) {}
+	PooledBuffer(const PooledBuffer&) = delete;
+	PooledBuffer& operator=(const PooledBuffer&) = delete;
+	void giveBack();
+
+	BufferPool* pool;
+	size_t bucket;
+	MemHandle buf;
+};
+
+class BufferPool
+{
+public:
+	explicit BufferPool(cl_context ctx) : ctx(ctx), idleBytes(0), maxIdleBytes(static_cast<size_t>(1) << 30) {}
+
+	// A buffer of at least "size" bytes, reused if an idle one is available.
+	PooledBuffer acquire(size_t size);
+
+	// Release every idle buffer (e.g., before a phase that needs lots of
+	// device memory).
+	void trim();
+
+	// Buffers given back while the pool already holds this many idle bytes
+	// are released instead of kept. (Default: 1 GiB)
+	void setMaxIdleBytes(size_t bytes) { maxIdleBytes = bytes; }
+	size_t bytesIdle() const { return idleBytes; }
+
+	// The bucket (i.e., actual buffer size) used for a request of "size" bytes
+	static size_t bucketSize(size_t size);
+
+private:
+	friend class PooledBuffer;
+	BufferPool(const BufferPool&) = delete;
+	BufferPool& operator=(const BufferPool&) = delete;
+	void giveBack(size_t bucket, MemHandle buf);
+
+	cl_context ctx;
+	size_t idleBytes, maxIdleBytes;
+	std::map<size_t, std::vector<MemHandle> > idle; // bucket size -> idle buffers
+};
+
+#endif
@@ -0,0 +1,111 @@
+// CLHandle.h: RAII ownership of OpenCL objects.
+//
+// A CLHandle<T> releases the object it holds when it goes out of scope.
+// Copying a handle retains the object (so both copies may be released
+// independently); moving a handle transfers ownership without touching
+// the reference count.
+
+#ifndef CLHANDLE_H
+#define CLHANDLE_H
+
+#include <utility>
+
+#ifdef __APPLE__
+#include <OpenCL/opencl.h>
+#else
+#include <CL/opencl.h>
+#endif
+
+template <typename T> struct CLRefCount;
+
+template <> struct CLRefCount<cl_mem>
+{
+	static void retain(cl_mem m) { clRetainMemObject(m); }
+	static void release(cl_mem m) { clReleaseMemObject(m); }
+};
+
+template <> struct CLRefCount<cl_kernel>
+{
+	static void retain(cl_kernel k) { clRetainKernel(k); }
+	static void release(cl_kernel k) { clReleaseKernel(k); }
+};
+
+template <> struct CLRefCount<cl_program>
+{
+	static void retain(cl_program p) { clRetainProgram(p); }
+	static void release(cl_program p) { clReleaseProgram(p); }
+};
+
+template <> struct CLRefCount<cl_event>
+{
+	static void retain(cl_event e) { clRetainEvent(e); }
+	static void release(cl_event e) { clReleaseEvent(e); }
+};
+
+template <> struct CLRefCount<cl_command_queue>
+{
+	static void retain(cl_command_queue q) { clRetainCommandQueue(q); }
+	static void release(cl_command_queue q) { clReleaseCommandQueue(q); }
+};
+
+// Only sub-devices (from clCreateSubDevices) are reference counted; for
+// root devices, retain and release do nothing.
+template <> struct CLRefCount<cl_device_id>
+{
+	static void retain(cl_device_id d) { clRetainDevice(d); }
+	static void release(cl_device_id d) { clReleaseDevice(d); }
+};
+
+template <> struct CLRefCount<cl_context>
+{
+	static void retain(cl_context c) { clRetainContext(c); }
+	static void release(cl_context c) { clReleaseContext(c); }
+};
+
+template <typename T>
+class CLHandle
+{
+public:
+	CLHandle() : obj(nullptr) {}
+	// Takes ownership of "o" (i.e., of the reference returned by clCreateXxx).
+	explicit CLHandle(T o) : obj(o) {}
+	CLHandle(const CLHandle& h) : obj(h.obj)
+	{
+		if (obj != nullptr)
+			CLRefCount<T>::retain(obj);
+	}
+	CLHandle(CLHandle&& h) noexcept : obj(h.obj) { h.obj = nullptr; }
+	~CLHandle() { reset(); }
+
+	CLHandle& operator=(CLHandle h) // copy or move, then swap
+	{
+		std::swap(obj, h.obj);
+		return *this;
+	}
+
+	// Returned by reference so that "&h.get()" can be handed to clSetKernelArg.
+	const T& get() const { return obj; }
+	operator T() const { return obj; }
+	explicit operator bool() const { return obj != nullptr; }
+
+	// Release the current object (if any) and take ownership of "o".
+	void reset(T o = nullptr)
+	{
+		if (obj != nullptr)
+			CLRefCount<T>::release(obj);
+		obj = o;
+	}
+
+private:
+	T obj;
+};
+
+typedef CLHandle<cl_mem> MemHandle;
+typedef CLHandle<cl_kernel> KernelHandle;
+typedef CLHandle<cl_program> ProgramHandle;
+typedef CLHandle<cl_event> EventHandle;
+typedef CLHandle<cl_command_queue> QueueHandle;
+typedef CLHandle<cl_context> ContextHandle;
+typedef CLHandle<cl_device_id> DeviceHandle;
+
+#endif
@@ -0,0 +1,95 @@
+// HostArray.h: Host arrays that kernels can use without copies.
+//
+// A HostArray<T> is an OpenCL buffer whose storage the host can reach
+// directly. The host accesses it between map() and unmap(); kernels use
+// buffer() while it is unmapped. On devices that share memory with the
+// host (CPU devices, most integrated GPUs), map and unmap are essentially
+// free, so there is no clEnqueueWriteBuffer/clEnqueueReadBuffer copy at
+// all. On discrete GPUs the implementation moves the data as needed.
+//
+// Two ways to get the storage:
+//  - CL_MEM_ALLOC_HOST_PTR: the implementation allocates host-accessible
+//    memory itself (usually the best choice);
+//  - CL_MEM_USE_HOST_PTR: we allocate page-aligned memory and ask the
+//    implementation to use it in place.
+
+#ifndef HOSTARRAY_H
+#define HOSTARRAY_H
+
+#include <stdlib.h>
+
+#include "OpenCLRuntime.h"
+#include "BufferPool.h"
+
+template <typename T>
+class HostArray
+{
+public:
+	HostArray(OpenCLRuntime& rt, size_t n, cl_mem_flags hostPtrFlag = CL_MEM_ALLOC_HOST_PTR) :
+		cmdQueue(rt.queue()), n(n), hostMem(nullptr), mappedPtr(nullptr)
+	{
+		if (hostPtrFlag == CL_MEM_USE_HOST_PTR)
+		{
+			// Page alignment satisfies CL_DEVICE_MEM_BASE_ADDR_ALIGN everywhere
+			// we know of, and is what implementations want for zero-copy.
+			if (posix_memalign(&hostMem, 4096, bytes()) != 0)
+				checkStatus("posix_memalign-HostArray", CL_OUT_OF_HOST_MEMORY, true);
+		}
+		buf = rt.createBuffer(CL_MEM_READ_WRITE | hostPtrFlag, bytes(), hostMem);
+	}
+	~HostArray()
+	{
+		unmap();
+		buf.reset();
+		if (hostMem != nullptr)
+		{
+			// The implementation may use hostMem until the buffer is gone
+			clFinish(cmdQueue);
+			free(hostMem);
+		}
+	}
+
+	// Map the whole array for host access (blocking); "flags" is CL_MAP_READ,
+	// CL_MAP_WRITE, or both. Returns the host pointer, valid until unmap().
+	T* map(cl_map_flags flags = CL_MAP_READ | CL_MAP_WRITE)
+	{
+		if (mappedPtr != nullptr)
+			return mappedPtr;
+		cl_int status;
+		mappedPtr = static_cast<T*>(clEnqueueMapBuffer(cmdQueue, buf, CL_TRUE, flags,
+			0, bytes(), 0, nullptr, nullptr, &status));
+		checkStatus("clEnqueueMapBuffer-HostArray", status, true);
+		allocationCounters.mapCalls++;
+		return mappedPtr;
+	}
+
+	// Hand the array back to the device. Must be called before a kernel
+	// uses buffer(); kernels enqueued afterwards see the host's writes.
+	void unmap()
+	{
+		if (mappedPtr == nullptr)
+			return;
+		cl_int status = clEnqueueUnmapMemObject(cmdQueue, buf, mappedPtr, 0, nullptr, nullptr);
+		checkStatus("clEnqueueUnmapMemObject-HostArray", status, true);
+		mappedPtr = nullptr;
+	}
+
+	// The host pointer while mapped; nullptr otherwise.
+	T* data() const { return mappedPtr; }
+	// Returned by reference so that "&a.buffer()" can be handed to clSetKernelArg.
+	const cl_mem& buffer() const { return buf.get(); }
+	size_t size() const { return n; }
+	size_t bytes() const { return n * sizeof(T); }
+
+private:
+	HostArray(const HostArray&) = delete;
+	HostArray& operator=(const HostArray&) = delete;
+
+	cl_command_queue cmdQueue;
+	size_t n;
+	void* hostMem;  // only for CL_MEM_USE_HOST_PTR
+	T* mappedPtr;
+	MemHandle buf;
+};
+
+#endif
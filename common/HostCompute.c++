@@ -0,0 +1,542 @@
+// HostCompute.c++: The examples' kernels on the host, with SIMD and threads.
+
+#include <algorithm>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HostCompute.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HOST_X86
+#include <immintrin.h>
+#endif
+
+// ---------------------------------------------------------------------
+// ThreadPool
+// ---------------------------------------------------------------------
+
+static size_t hostThreadCount()
+{
+	const char* threads = getenv("GPGPU_HOST_THREADS");
+	if ((threads != nullptr) && (atoi(threads) > 0))
+		return atoi(threads);
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool& ThreadPool::get()
+{
+	static ThreadPool pool(hostThreadCount());
+	return pool;
+}
+
+ThreadPool::ThreadPool(size_t nThreads) :
+	stopping(false), generation(0), busyWorkers(0), job(nullptr),
+	jobSize(0), pieceSize(0), nextPiece(0), nPieces(0)
+{
+	for (size_t t=1 ; t<nThreads ; t++)
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t t=0 ; t<workers.size() ; t++)
+		workers[t].join();
+}
+
+void ThreadPool::parallelFor(size_t n, size_t grain, const std::function<void(size_t, size_t)>& f)
+{
+	if (n == 0)
+		return;
+	grain = std::max<size_t>(grain, 1);
+	size_t maxPieces = (n + grain - 1) / grain;
+	if (workers.empty() || (maxPieces == 1))
+	{
+		f(0, n);
+		return;
+	}
+
+	std::lock_guard<std::mutex> call(callLock);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		// A few pieces per thread, so that one slow thread does not hold
+		// up the rest
+		size_t pieces = std::min(maxPieces, 4 * size());
+		pieceSize = (n + pieces - 1) / pieces;
+		nPieces = (n + pieceSize - 1) / pieceSize;
+		nextPiece = 0;
+		jobSize = n;
+		job = &f;
+		busyWorkers = workers.size();
+		generation++;
+	}
+	wake.notify_all();
+	runPieces();
+
+	std::unique_lock<std::mutex> guard(lock);
+	finished.wait(guard, [this] { return busyWorkers == 0; });
+	job = nullptr;
+}
+
+void ThreadPool::runPieces()
+{
+	for (;;)
+	{
+		size_t piece;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (nextPiece >= nPieces)
+				return;
+			piece = nextPiece++;
+		}
+		size_t begin = piece * pieceSize;
+		(*job)(begin, std::min(jobSize, begin + pieceSize));
+	}
+}
+
+void ThreadPool::workerLoop()
+{
+	unsigned long seen = 0;
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			wake.wait(guard, [&] { return stopping || (generation != seen); });
+			if (stopping)
+				return;
+			seen = generation;
+		}
+		runPieces();
+		std::lock_guard<std::mutex> guard(lock);
+		if (--busyWorkers == 0)
+			finished.notify_one();
+	}
+}
+
+// ---------------------------------------------------------------------
+// Choosing the instruction set and the backend
+// ---------------------------------------------------------------------
+
+const char* hostSimdName(HostSimd level)
+{
+	switch (level)
+	{
+		case HOST_AVX512:
+			return "avx512";
+		case HOST_AVX2:
+			return "avx2";
+		default:
+			return "scalar";
+	}
+}
+
+HostSimd hostSimdLevel()
+{
+	static HostSimd level = HOST_SCALAR;
+	static bool known = false;
+	if (known)
+		return level;
+	known = true;
+#ifdef HOST_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		level = __builtin_cpu_supports("avx512f") ? HOST_AVX512 : HOST_AVX2;
+#endif
+	const char* cap = getenv("GPGPU_HOST_SIMD");
+	if (cap != nullptr)
+		for (int l=HOST_SCALAR ; l<level ; l++)
+			if (strcmp(cap, hostSimdName(static_cast<HostSimd>(l))) == 0)
+				level = static_cast<HostSimd>(l);
+	return level;
+}
+
+bool preferHost(double bytes, double flops)
+{
+	const char* backend = getenv("GPGPU_BACKEND");
+	if ((backend != nullptr) && (strcmp(backend, "host") == 0))
+		return true;
+	if ((backend != nullptr) && (strcmp(backend, "opencl") == 0))
+		return false;
+	// Rough, deliberately conservative rates: 2 GFLOP/s per thread and
+	// 10 GB/s of memory bandwidth, against 100 microseconds for a launch
+	// and a blocking read on a typical driver.
+	double hostSeconds = flops / (hostThreadCount() * 2.0e9) + bytes / 1.0e10;
+	return hostSeconds < 1.0e-4;
+}
+
+// ---------------------------------------------------------------------
+// vecadd: sin and cos after Cephes' sinf and cosf (as in Julien Pommier's
+// sse_mathfun): reduce to [-pi/4, pi/4] in three pieces of pi/4 and use a
+// polynomial for sin or cos, as the octant requires. Good to a couple of
+// ulps for |x| < 8192; vectors with larger (or non-finite) elements go
+// to the C library.
+// ---------------------------------------------------------------------
+
+static void vecaddTrigScalar(const float* A, const float* B, float* C, size_t begin, size_t end)
+{
+	for (size_t i=begin ; i<end ; i++)
+	{
+		C[2*i] = cosf(A[i]);
+		C[2*i+1] = sinf(B[i]);
+	}
+}
+
+#ifdef HOST_X86
+
+__attribute__((target("avx2,fma")))
+static void sinCosAVX2(__m256 x, __m256& sinX, __m256& cosX)
+{
+	const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+	__m256 sinSign = _mm256_and_ps(x, signMask);
+	x = _mm256_andnot_ps(signMask, x); // |x|
+
+	// The octant, rounded up to even
+	__m256i j = _mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.27323954473516f))); // 4/pi
+	j = _mm256_and_si256(_mm256_add_epi32(j, _mm256_set1_epi32(1)), _mm256_set1_epi32(~1));
+	__m256 y = _mm256_cvtepi32_ps(j);
+
+	__m256 sinSwap = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(j, _mm256_set1_epi32(4)), 29));
+	__m256 useSinPoly = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(j, _mm256_set1_epi32(2)),
+		_mm256_setzero_si256()));
+	__m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_andnot_si256(
+		_mm256_sub_epi32(j, _mm256_set1_epi32(2)), _mm256_set1_epi32(4)), 29));
+	sinSign = _mm256_xor_ps(sinSign, sinSwap);
+
+	// x - y*pi/4, with pi/4 in three pieces so that the products are exact
+	x = _mm256_fmadd_ps(y, _mm256_set1_ps(-0.78515625f), x);
+	x = _mm256_fmadd_ps(y, _mm256_set1_ps(-2.4187564849853515625e-4f), x);
+	x = _mm256_fmadd_ps(y, _mm256_set1_ps(-3.77489497744594108e-8f), x);
+	__m256 z = _mm256_mul_ps(x, x);
+
+	// cos(x) for |x| <= pi/4
+	__m256 c = _mm256_set1_ps(2.443315711809948e-5f);
+	c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(-1.388731625493765e-3f));
+	c = _mm256_fmadd_ps(c, z, _mm256_set1_ps(4.166664568298827e-2f));
+	c = _mm256_mul_ps(_mm256_mul_ps(c, z), z);
+	c = _mm256_fnmadd_ps(_mm256_set1_ps(0.5f), z, c);
+	c = _mm256_add_ps(c, _mm256_set1_ps(1.0f));
+	// sin(x) for |x| <= pi/4
+	__m256 s = _mm256_set1_ps(-1.9515295891e-4f);
+	s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(8.3321608736e-3f));
+	s = _mm256_fmadd_ps(s, z, _mm256_set1_ps(-1.6666654611e-1f));
+	s = _mm256_fmadd_ps(_mm256_mul_ps(s, z), x, x);
+
+	sinX = _mm256_xor_ps(_mm256_blendv_ps(c, s, useSinPoly), sinSign);
+	cosX = _mm256_xor_ps(_mm256_blendv_ps(s, c, useSinPoly), cosSign);
+}
+
+__attribute__((target("avx2,fma")))
+static void vecaddTrigAVX2(const float* A, const float* B, float* C, size_t begin, size_t end)
+{
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 limit = _mm256_set1_ps(8192.0f);
+	size_t i = begin;
+	for ( ; i+8<=end ; i+=8)
+	{
+		__m256 a = _mm256_loadu_ps(A + i);
+		__m256 b = _mm256_loadu_ps(B + i);
+		// Ordered comparisons are false for NaN
+		__m256 inRange = _mm256_and_ps(_mm256_cmp_ps(_mm256_and_ps(a, absMask), limit, _CMP_LE_OQ),
+			_mm256_cmp_ps(_mm256_and_ps(b, absMask), limit, _CMP_LE_OQ));
+		if (_mm256_movemask_ps(inRange) != 0xff)
+		{
+			vecaddTrigScalar(A, B, C, i, i+8);
+			continue;
+		}
+		__m256 sinA, cosA, sinB, cosB;
+		sinCosAVX2(a, sinA, cosA);
+		sinCosAVX2(b, sinB, cosB);
+		// Interleave: cos(A[i]), sin(B[i]), cos(A[i+1]), ...
+		__m256 lo = _mm256_unpacklo_ps(cosA, sinB); // elements 0, 1, 4, 5
+		__m256 hi = _mm256_unpackhi_ps(cosA, sinB); // elements 2, 3, 6, 7
+		_mm256_storeu_ps(C + 2*i, _mm256_permute2f128_ps(lo, hi, 0x20));
+		_mm256_storeu_ps(C + 2*i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+	}
+	vecaddTrigScalar(A, B, C, i, end);
+}
+
+#endif
+
+void hostVecaddTrig(const float* A, const float* B, float* C, size_t n)
+{
+	HostSimd level = hostSimdLevel();
+	ThreadPool::get().parallelFor(n, 1 << 14, [=](size_t begin, size_t end)
+	{
+#ifdef HOST_X86
+		// (There is no AVX-512 version; AVX-512 CPUs run the AVX2 one.)
+		if (level != HOST_SCALAR)
+		{
+			vecaddTrigAVX2(A, B, C, begin, end);
+			return;
+		}
+#endif
+		vecaddTrigScalar(A, B, C, begin, end);
+	});
+}
+
+// ---------------------------------------------------------------------
+// saxpy and daxpy
+// ---------------------------------------------------------------------
+
+template <typename T>
+static void axpyScalar(T a, const T* X, const T* Y, T* Z, size_t begin, size_t end)
+{
+	for (size_t i=begin ; i<end ; i++)
+		Z[i] = a * X[i] + Y[i];
+}
+
+#ifdef HOST_X86
+
+__attribute__((target("avx2,fma")))
+static void saxpyAVX2(float a, const float* X, const float* Y, float* Z, size_t begin, size_t end)
+{
+	__m256 va = _mm256_set1_ps(a);
+	size_t i = begin;
+	for ( ; i+8<=end ; i+=8)
+		_mm256_storeu_ps(Z + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(X + i), _mm256_loadu_ps(Y + i)));
+	axpyScalar(a, X, Y, Z, i, end);
+}
+
+__attribute__((target("avx512f")))
+static void saxpyAVX512(float a, const float* X, const float* Y, float* Z, size_t begin, size_t end)
+{
+	__m512 va = _mm512_set1_ps(a);
+	for (size_t i=begin ; i<end ; i+=16)
+	{
+		// The last vector may be partial; masked-off elements are neither
+		// read nor written
+		__mmask16 m = (end - i >= 16) ? 0xffff : static_cast<__mmask16>((1u << (end - i)) - 1);
+		__m512 z = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(m, X + i), _mm512_maskz_loadu_ps(m, Y + i));
+		_mm512_mask_storeu_ps(Z + i, m, z);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void daxpyAVX2(double a, const double* X, const double* Y, double* Z, size_t begin, size_t end)
+{
+	__m256d va = _mm256_set1_pd(a);
+	size_t i = begin;
+	for ( ; i+4<=end ; i+=4)
+		_mm256_storeu_pd(Z + i, _mm256_fmadd_pd(va, _mm256_loadu_pd(X + i), _mm256_loadu_pd(Y + i)));
+	axpyScalar(a, X, Y, Z, i, end);
+}
+
+__attribute__((target("avx512f")))
+static void daxpyAVX512(double a, const double* X, const double* Y, double* Z, size_t begin, size_t end)
+{
+	__m512d va = _mm512_set1_pd(a);
+	for (size_t i=begin ; i<end ; i+=8)
+	{
+		__mmask8 m = (end - i >= 8) ? 0xff : static_cast<__mmask8>((1u << (end - i)) - 1);
+		__m512d z = _mm512_fmadd_pd(va, _mm512_maskz_loadu_pd(m, X + i), _mm512_maskz_loadu_pd(m, Y + i));
+		_mm512_mask_storeu_pd(Z + i, m, z);
+	}
+}
+
+#endif
+
+// Memory-bound: pieces big enough that the threads stream whole pages
+static const size_t axpyGrain = 1 << 16;
+
+void hostSaxpy(float a, const float* X, const float* Y, size_t n, float* Z)
+{
+	HostSimd level = hostSimdLevel();
+	ThreadPool::get().parallelFor(n, axpyGrain, [=](size_t begin, size_t end)
+	{
+#ifdef HOST_X86
+		if (level == HOST_AVX512)
+			saxpyAVX512(a, X, Y, Z, begin, end);
+		else if (level == HOST_AVX2)
+			saxpyAVX2(a, X, Y, Z, begin, end);
+		else
+#endif
+			axpyScalar(a, X, Y, Z, begin, end);
+	});
+}
+
+void hostDaxpy(double a, const double* X, const double* Y, size_t n, double* Z)
+{
+	HostSimd level = hostSimdLevel();
+	ThreadPool::get().parallelFor(n, axpyGrain, [=](size_t begin, size_t end)
+	{
+#ifdef HOST_X86
+		if (level == HOST_AVX512)
+			daxpyAVX512(a, X, Y, Z, begin, end);
+		else if (level == HOST_AVX2)
+			daxpyAVX2(a, X, Y, Z, begin, end);
+		else
+#endif
+			axpyScalar(a, X, Y, Z, begin, end);
+	});
+}
+
+// ---------------------------------------------------------------------
+// Matrix multiply. Each thread computes a block of rows of C. Within it,
+// K and N are cut into panels so that the panel of B being used stays in
+// cache, and C is computed in tiles of up to 4 rows by 2 vectors, kept in
+// registers while the tile's rows of A and the panel's rows of B stream
+// past. Partial tiles at the right edge use masked loads and stores.
+// ---------------------------------------------------------------------
+
+static const size_t panelK = 128;  // rows of B per panel
+static const size_t panelN = 512;  // columns of B per panel (512 KiB of doubles)
+static const int tileRows = 4;
+
+static void matrixMultiplyScalar(const double* A, const double* B, double* C, size_t N, size_t K,
+	size_t firstRow, size_t endRow)
+{
+	for (size_t k0=0 ; k0<K ; k0+=panelK)
+		for (size_t j0=0 ; j0<N ; j0+=panelN)
+		{
+			size_t k1 = std::min(K, k0 + panelK);
+			size_t j1 = std::min(N, j0 + panelN);
+			for (size_t row=firstRow ; row<endRow ; row++)
+				for (size_t k=k0 ; k<k1 ; k++)
+				{
+					double a = A[row*K + k];
+					for (size_t col=j0 ; col<j1 ; col++)
+						C[row*N + col] += a * B[k*N + col];
+				}
+		}
+}
+
+#ifdef HOST_X86
+
+template <int ROWS>
+__attribute__((target("avx2,fma")))
+static void tileAVX2(const double* A, const double* B, double* C, size_t N, size_t K,
+	size_t row, size_t col, size_t k0, size_t k1, __m256i m0, __m256i m1)
+{
+	__m256d c[ROWS][2];
+	for (int r=0 ; r<ROWS ; r++)
+	{
+		c[r][0] = _mm256_maskload_pd(C + (row+r)*N + col, m0);
+		c[r][1] = _mm256_maskload_pd(C + (row+r)*N + col + 4, m1);
+	}
+	for (size_t k=k0 ; k<k1 ; k++)
+	{
+		__m256d b0 = _mm256_maskload_pd(B + k*N + col, m0);
+		__m256d b1 = _mm256_maskload_pd(B + k*N + col + 4, m1);
+		for (int r=0 ; r<ROWS ; r++)
+		{
+			__m256d a = _mm256_broadcast_sd(A + (row+r)*K + k);
+			c[r][0] = _mm256_fmadd_pd(a, b0, c[r][0]);
+			c[r][1] = _mm256_fmadd_pd(a, b1, c[r][1]);
+		}
+	}
+	for (int r=0 ; r<ROWS ; r++)
+	{
+		_mm256_maskstore_pd(C + (row+r)*N + col, m0, c[r][0]);
+		_mm256_maskstore_pd(C + (row+r)*N + col + 4, m1, c[r][1]);
+	}
+}
+
+__attribute__((target("avx2,fma")))
+static void matrixMultiplyAVX2(const double* A, const double* B, double* C, size_t N, size_t K,
+	size_t firstRow, size_t endRow)
+{
+	const __m256i lanes0 = _mm256_setr_epi64x(0, 1, 2, 3);
+	const __m256i lanes1 = _mm256_setr_epi64x(4, 5, 6, 7);
+	for (size_t k0=0 ; k0<K ; k0+=panelK)
+		for (size_t j0=0 ; j0<N ; j0+=panelN)
+		{
+			size_t k1 = std::min(K, k0 + panelK);
+			size_t j1 = std::min(N, j0 + panelN);
+			for (size_t row=firstRow ; row<endRow ; row+=tileRows)
+				for (size_t col=j0 ; col<j1 ; col+=8)
+				{
+					__m256i width = _mm256_set1_epi64x(static_cast<long long>(std::min<size_t>(8, j1 - col)));
+					__m256i m0 = _mm256_cmpgt_epi64(width, lanes0);
+					__m256i m1 = _mm256_cmpgt_epi64(width, lanes1);
+					switch (std::min<size_t>(tileRows, endRow - row))
+					{
+						case 4: tileAVX2<4>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						case 3: tileAVX2<3>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						case 2: tileAVX2<2>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						default: tileAVX2<1>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+					}
+				}
+		}
+}
+
+template <int ROWS>
+__attribute__((target("avx512f")))
+static void tileAVX512(const double* A, const double* B, double* C, size_t N, size_t K,
+	size_t row, size_t col, size_t k0, size_t k1, __mmask8 m0, __mmask8 m1)
+{
+	__m512d c[ROWS][2];
+	for (int r=0 ; r<ROWS ; r++)
+	{
+		c[r][0] = _mm512_maskz_loadu_pd(m0, C + (row+r)*N + col);
+		c[r][1] = _mm512_maskz_loadu_pd(m1, C + (row+r)*N + col + 8);
+	}
+	for (size_t k=k0 ; k<k1 ; k++)
+	{
+		__m512d b0 = _mm512_maskz_loadu_pd(m0, B + k*N + col);
+		__m512d b1 = _mm512_maskz_loadu_pd(m1, B + k*N + col + 8);
+		for (int r=0 ; r<ROWS ; r++)
+		{
+			__m512d a = _mm512_set1_pd(A[(row+r)*K + k]);
+			c[r][0] = _mm512_fmadd_pd(a, b0, c[r][0]);
+			c[r][1] = _mm512_fmadd_pd(a, b1, c[r][1]);
+		}
+	}
+	for (int r=0 ; r<ROWS ; r++)
+	{
+		_mm512_mask_storeu_pd(C + (row+r)*N + col, m0, c[r][0]);
+		_mm512_mask_storeu_pd(C + (row+r)*N + col + 8, m1, c[r][1]);
+	}
+}
+
+__attribute__((target("avx512f")))
+static void matrixMultiplyAVX512(const double* A, const double* B, double* C, size_t N, size_t K,
+	size_t firstRow, size_t endRow)
+{
+	for (size_t k0=0 ; k0<K ; k0+=panelK)
+		for (size_t j0=0 ; j0<N ; j0+=panelN)
+		{
+			size_t k1 = std::min(K, k0 + panelK);
+			size_t j1 = std::min(N, j0 + panelN);
+			for (size_t row=firstRow ; row<endRow ; row+=tileRows)
+				for (size_t col=j0 ; col<j1 ; col+=16)
+				{
+					size_t width = std::min<size_t>(16, j1 - col);
+					__mmask8 m0 = (width >= 8) ? 0xff : static_cast<__mmask8>((1u << width) - 1);
+					__mmask8 m1 = (width >= 16) ? 0xff : (width <= 8) ? 0 : static_cast<__mmask8>((1u << (width - 8)) - 1);
+					switch (std::min<size_t>(tileRows, endRow - row))
+					{
+						case 4: tileAVX512<4>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						case 3: tileAVX512<3>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						case 2: tileAVX512<2>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+						default: tileAVX512<1>(A, B, C, N, K, row, col, k0, k1, m0, m1); break;
+					}
+				}
+		}
+}
+
+#endif
+
+void hostMatrixMultiply(const double* A, const double* B, double* C, size_t M, size_t N, size_t K)
+{
+	HostSimd level = hostSimdLevel();
+	// About a million multiply-adds per piece, in whole tiles
+	size_t grain = std::max<size_t>(1000000 / (std::max<size_t>(N, 1) * std::max<size_t>(K, 1)), 1);
+	grain = ((grain + tileRows - 1) / tileRows) * tileRows;
+	ThreadPool::get().parallelFor(M, grain, [=](size_t firstRow, size_t endRow)
+	{
+		std::fill(C + firstRow*N, C + endRow*N, 0.0);
+#ifdef HOST_X86
+		if (level == HOST_AVX512)
+			matrixMultiplyAVX512(A, B, C, N, K, firstRow, endRow);
+		else if (level == HOST_AVX2)
+			matrixMultiplyAVX2(A, B, C, N, K, firstRow, endRow);
+		else
+#endif
+			matrixMultiplyScalar(A, B, C, N, K, firstRow, endRow);
+	});
+}
@@ -0,0 +1,83 @@
+// HostCompute.h: The examples' kernels on the host, with SIMD and threads.
+//
+// Each function computes what the kernel of the same name does on the
+// device, using all the host's cores (a ThreadPool) and its widest vector
+// instructions: AVX-512 or AVX2 + FMA when the CPU has them (chosen when
+// the program runs, so one binary works everywhere), else plain loops.
+// The examples use these when there is no OpenCL platform, or when a
+// problem is too small for the device to pay off its launch and transfer
+// costs (see preferHost), and as a fast reference to check device results.
+//
+// $GPGPU_HOST_THREADS sets the number of threads (default: one per
+// hardware thread). $GPGPU_HOST_SIMD ("scalar", "avx2", or "avx512") caps
+// the instruction set used, e.g., to compare them.
+
+#ifndef HOSTCOMPUTE_H
+#define HOSTCOMPUTE_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+
+class ThreadPool
+{
+public:
+	// The process's pool, created on first use
+	static ThreadPool& get();
+
+	// "nThreads" includes the thread calling parallelFor, so nThreads - 1
+	// threads are started.
+	explicit ThreadPool(size_t nThreads);
+	~ThreadPool();
+
+	size_t size() const { return workers.size() + 1; }
+
+	// Calls f(begin, end) on disjoint pieces covering [0, n), each at least
+	// "grain" items (but the last), on the pool's threads and the calling
+	// thread, and returns when all are done. Small problems run entirely
+	// on the calling thread. Calls from several threads take turns.
+	void parallelFor(size_t n, size_t grain, const std::function<void(size_t, size_t)>& f);
+
+private:
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+	void workerLoop();
+	void runPieces();
+
+	std::vector<std::thread> workers;
+	std::mutex callLock; // one parallelFor at a time
+	std::mutex lock;
+	std::condition_variable wake, finished;
+	bool stopping;
+	unsigned long generation; // incremented for every parallelFor
+	size_t busyWorkers;
+	// The current parallelFor
+	const std::function<void(size_t, size_t)>* job;
+	size_t jobSize, pieceSize, nextPiece, nPieces;
+};
+
+enum HostSimd { HOST_SCALAR, HOST_AVX2, HOST_AVX512 };
+// What the host functions use on this CPU
+HostSimd hostSimdLevel();
+const char* hostSimdName(HostSimd level);
+
+// Whether a problem that moves "bytes" to and from the device and does
+// "flops" operations is better done on the host: the host could finish it
+// in less time than a kernel launch and a blocking read take on their own.
+// $GPGPU_BACKEND, set to "host" or "opencl", overrides the estimate.
+bool preferHost(double bytes, double flops);
+
+// SimpleOpenCL.cl's vecadd: C[2*i] = cos(A[i]), C[2*i+1] = sin(B[i])
+void hostVecaddTrig(const float* A, const float* B, float* C, size_t n);
+
+// saxpy.cl and daxpy.cl: Z = a*X + Y
+void hostSaxpy(float a, const float* X, const float* Y, size_t n, float* Z);
+void hostDaxpy(double a, const double* X, const double* Y, size_t n, double* Z);
+
+// matrixMultiply*.cl: C (M x N) = A (M x K) * B (K x N), row-major
+void hostMatrixMultiply(const double* A, const double* B, double* C, size_t M, size_t N, size_t K);
+
+#endif
@@ -0,0 +1,77 @@
+// MappedFile.c++: A file's contents as an array in memory, via mmap.
+
+#include <iostream>
+#include <cstdlib>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "MappedFile.h"
+
+MappedFile::MappedFile(const std::string& path) : fd(-1), addr(nullptr), length(0)
+{
+	map(path, O_RDONLY, 0);
+}
+
+MappedFile::MappedFile(const std::string& path, size_t bytes) : fd(-1), addr(nullptr), length(0)
+{
+	map(path, O_RDWR | O_CREAT | O_TRUNC, bytes);
+}
+
+MappedFile::~MappedFile()
+{
+	if ((addr != nullptr) && (length > 0))
+		munmap(addr, length);
+	if (fd >= 0)
+		close(fd);
+}
+
+void MappedFile::adviseSequential()
+{
+	if ((addr != nullptr) && (length > 0))
+		madvise(addr, length, MADV_SEQUENTIAL);
+}
+
+void MappedFile::map(const std::string& path, int openFlags, size_t bytes)
+{
+	fd = open(path.c_str(), openFlags, 0644);
+	if (fd < 0)
+	{
+		std::cerr << "Could not open " << path << ": " << strerror(errno) << '\n';
+		exit(1);
+	}
+	bool writable = (openFlags & O_RDWR) != 0;
+	if (writable)
+	{
+		if (ftruncate(fd, bytes) != 0)
+		{
+			std::cerr << "Could not size " << path << " to " << bytes << " bytes: " << strerror(errno) << '\n';
+			exit(1);
+		}
+		length = bytes;
+	}
+	else
+	{
+		struct stat sb;
+		if (fstat(fd, &sb) != 0)
+		{
+			std::cerr << "Could not stat " << path << ": " << strerror(errno) << '\n';
+			exit(1);
+		}
+		length = sb.st_size;
+	}
+	if (length == 0)
+		return; // mmap rejects empty mappings; data() stays nullptr
+
+	int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	addr = mmap(nullptr, length, prot, MAP_SHARED, fd, 0);
+	if (addr == MAP_FAILED)
+	{
+		addr = nullptr;
+		std::cerr << "Could not map " << path << ": " << strerror(errno) << '\n';
+		exit(1);
+	}
+}
@@ -0,0 +1,38 @@
+// MappedFile.h: A file's contents as an array in memory, via mmap.
+//
+// Used to stream inputs that are larger than device (or even host) memory:
+// pages are read from disk as they are touched and can be dropped again by
+// the OS afterwards, so only the part of the file currently in flight needs
+// to be resident.
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+
+class MappedFile
+{
+public:
+	// Map an existing file for reading. Exits if it cannot be opened.
+	explicit MappedFile(const std::string& path);
+	// Create (or truncate) a file of "bytes" bytes and map it for writing.
+	MappedFile(const std::string& path, size_t bytes);
+	~MappedFile();
+
+	void* data() const { return addr; }
+	size_t size() const { return length; }
+
+	// Tell the OS we will read (or write) the file front to back.
+	void adviseSequential();
+
+private:
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	void map(const std::string& path, int openFlags, size_t bytes);
+
+	int fd;
+	void* addr;
+	size_t length;
+};
+
+#endif
@@ -0,0 +1,46 @@
+// MatrixCheck.c++: Inputs and result checks shared by the matrix multiply
+// examples.
+
+#include <iostream>
+#include <math.h>
+
+#include "MatrixCheck.h"
+
+void fillInputs(double* A, double* B, size_t M, size_t N, size_t K)
+{
+	for (size_t i=0 ; i<M*K ; i++)
+		A[i] = static_cast<double>((i*7 + 3) % 19) / 9.0 - 1.0;
+	for (size_t i=0 ; i<K*N ; i++)
+		B[i] = static_cast<double>((i*5 + 1) % 23) / 11.0 - 1.0;
+}
+
+void naiveMatrixMultiply(const double* A, const double* B, double* C, size_t M, size_t N, size_t K)
+{
+	for (size_t i=0 ; i<M*N ; i++)
+		C[i] = 0.0;
+	for (size_t row=0 ; row<M ; row++)
+		for (size_t k=0 ; k<K ; k++)
+		{
+			double a = A[row*K + k];
+			for (size_t col=0 ; col<N ; col++)
+				C[row*N + col] += a * B[k*N + col];
+		}
+}
+
+int compareToReference(const double* C, const double* ref, size_t M, size_t N, size_t K)
+{
+	double tolerance = 1.0e-12 * K;
+	double maxDiff = 0.0;
+	int nBad = 0;
+	for (size_t i=0 ; i<M*N ; i++)
+	{
+		double diff = fabs(C[i] - ref[i]);
+		if (diff > maxDiff)
+			maxDiff = diff;
+		if (!(diff <= tolerance)) // also catches NaN
+			nBad++;
+	}
+	std::cout << "Compared with host reference: " << nBad << " of " << (M*N)
+	          << " elements out of tolerance, maxDiff = " << maxDiff << '\n';
+	return nBad;
+}
@@ -0,0 +1,24 @@
+// MatrixCheck.h: Inputs and result checks shared by the matrix multiply
+// examples (ex 4), so that every version is checked the same way.
+//
+// Matrices are row-major doubles: A is M x K, B is K x N, and C is M x N.
+
+#ifndef MATRIXCHECK_H
+#define MATRIXCHECK_H
+
+#include <stddef.h>
+
+// Values in [-1, 1] with no simple structure, so that indexing errors
+// (e.g., mixing up M, N, and K) show up in the comparison.
+void fillInputs(double* A, double* B, size_t M, size_t N, size_t K);
+
+// C = A * B with plain loops, ordered (i, k, j) so the inner loop walks B
+// and C with unit stride. This checks hostMatrixMultiply (HostCompute.h),
+// which is in turn the (much faster) reference for the kernels.
+void naiveMatrixMultiply(const double* A, const double* B, double* C, size_t M, size_t N, size_t K);
+
+// Returns the number of elements of C that differ from the reference by
+// more than a tolerance that grows with the length of the dot products.
+int compareToReference(const double* C, const double* ref, size_t M, size_t N, size_t K);
+
+#endif
@@ -0,0 +1,273 @@
+// MultiDevice.c++: Split one problem across every device on every platform.
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <stdlib.h>
+
+#include "MultiDevice.h"
+#include "OpenCLRuntime.h"
+#include "ProgramCache.h"
+
+ComputeDevice::ComputeDevice(cl_platform_id platform, DeviceHandle dev, const std::string& name) :
+	devPlatform(platform), dev(std::move(dev)), devName(name)
+{
+	cl_device_id id = this->dev;
+	cl_int status;
+	ctx.reset(clCreateContext(nullptr, 1, &id, nullptr, nullptr, &status));
+	checkStatus("clCreateContext-" + devName, status, true);
+	cmdQueue.reset(clCreateCommandQueue(ctx, id, 0, &status));
+	checkStatus("clCreateCommandQueue-" + devName, status, true);
+}
+
+double ComputeDevice::nominalSpeed() const
+{
+	cl_uint computeUnits = 1, clockMHz = 1;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, nullptr);
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &clockMHz, nullptr);
+	return std::max(1.0, static_cast<double>(computeUnits) * clockMHz);
+}
+
+cl_program ComputeDevice::program(const std::string& fileName, const std::string& options)
+{
+	std::string key = fileName + '\n' + options;
+	std::map<std::string, ProgramHandle>::iterator it = programs.find(key);
+	if (it != programs.end())
+		return it->second;
+
+	const char* source = readSource(fileName.c_str());
+	ProgramHandle pgm = buildProgramCached(ctx, dev, source, options);
+	free(const_cast<char*>(source));
+
+	programs[key] = pgm;
+	return pgm;
+}
+
+cl_kernel ComputeDevice::kernel(const std::string& fileName, const std::string& kernelName,
+	const std::string& options)
+{
+	std::string key = fileName + '\n' + options + '\n' + kernelName;
+	std::map<std::string, KernelHandle>::iterator it = kernels.find(key);
+	if (it != kernels.end())
+		return it->second;
+
+	cl_int status;
+	KernelHandle k(clCreateKernel(program(fileName, options), kernelName.c_str(), &status));
+	checkStatus("clCreateKernel-" + kernelName, status, true);
+
+	kernels[key] = k;
+	return k;
+}
+
+MemHandle ComputeDevice::createBuffer(cl_mem_flags flags, size_t size, void* hostPtr)
+{
+	cl_int status;
+	MemHandle buf(clCreateBuffer(ctx, flags, size, hostPtr, &status));
+	checkStatus("clCreateBuffer-" + devName, status, true);
+	allocationCounters.buffersCreated++;
+	allocationCounters.bytesCreated += size;
+	return buf;
+}
+
+// Whether $GPGPU_DEVICES (if set) asks for this device
+static bool deviceWanted(const PlatformDevice& pd)
+{
+	const char* wanted = getenv("GPGPU_DEVICES");
+	if ((wanted == nullptr) || (wanted[0] == '\0'))
+		return true;
+	std::string devName = getDeviceString(pd.device, CL_DEVICE_NAME);
+	std::string platformName = getPlatformString(pd.platform, CL_PLATFORM_NAME);
+	std::stringstream ss(wanted);
+	std::string entry;
+	while (std::getline(ss, entry, ','))
+		if (!entry.empty() && ((devName.find(entry) != std::string::npos) ||
+		                       (platformName.find(entry) != std::string::npos)))
+			return true;
+	return false;
+}
+
+// Up to "count" sub-devices with equal shares of dev's compute units; empty
+// if the device cannot be partitioned that way.
+static std::vector<cl_device_id> partitionEqually(cl_device_id dev, int count)
+{
+	std::vector<cl_device_id> subs;
+	cl_uint maxSubDevices = 0, computeUnits = 0;
+	clGetDeviceInfo(dev, CL_DEVICE_PARTITION_MAX_SUB_DEVICES, sizeof(cl_uint), &maxSubDevices, nullptr);
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, nullptr);
+	if ((maxSubDevices < 2) || (computeUnits < 2))
+		return subs;
+
+	cl_device_partition_property props[] = {
+		CL_DEVICE_PARTITION_EQUALLY, static_cast<cl_device_partition_property>(std::max<cl_uint>(computeUnits / count, 1)), 0 };
+	cl_uint numSubs = 0;
+	cl_int status = clCreateSubDevices(dev, props, 0, nullptr, &numSubs);
+	if ((status != CL_SUCCESS) || (numSubs == 0))
+		return subs;
+	subs.resize(numSubs);
+	status = clCreateSubDevices(dev, props, numSubs, subs.data(), nullptr);
+	if (status != CL_SUCCESS)
+	{
+		subs.clear();
+		return subs;
+	}
+	// Integer division can leave a small extra sub-device; it is not wanted
+	while (subs.size() > static_cast<size_t>(count))
+	{
+		clReleaseDevice(subs.back());
+		subs.pop_back();
+	}
+	return subs;
+}
+
+ComputeDevices discoverDevices(cl_device_type desiredDeviceType, bool requireFP64, int subDevices)
+{
+	ComputeDevices result;
+	std::vector<PlatformDevice> found = findDevices(desiredDeviceType, requireFP64);
+	for (size_t i=0 ; i<found.size() ; i++)
+	{
+		if (!deviceWanted(found[i]))
+			continue;
+		std::string name = getDeviceString(found[i].device, CL_DEVICE_NAME);
+		if (subDevices > 1)
+		{
+			std::vector<cl_device_id> subs = partitionEqually(found[i].device, subDevices);
+			if (!subs.empty())
+			{
+				for (size_t s=0 ; s<subs.size() ; s++)
+					result.push_back(std::unique_ptr<ComputeDevice>(new ComputeDevice(found[i].platform,
+						DeviceHandle(subs[s]), name + " [sub-device " + std::to_string(s) + "]")));
+				continue;
+			}
+			std::cout << name << " cannot be partitioned; using the whole device\n";
+		}
+		result.push_back(std::unique_ptr<ComputeDevice>(new ComputeDevice(found[i].platform,
+			DeviceHandle(found[i].device), name)));
+	}
+	return result;
+}
+
+WorkScheduler::WorkScheduler(const std::vector<ComputeDevice*>& devices) :
+	devices(devices), devStats(devices.size()), stealing(true)
+{
+}
+
+// The chunks [next, end) a device has yet to run
+struct ChunkRange
+{
+	size_t next, end;
+	size_t remaining() const { return end - next; }
+};
+
+double WorkScheduler::run(size_t n, size_t chunkSize, const ChunkFunction& f)
+{
+	size_t nDevices = devices.size();
+	if ((n == 0) || (nDevices == 0))
+		return 0.0;
+	chunkSize = std::max<size_t>(chunkSize, 1);
+	size_t nChunks = (n + chunkSize - 1) / chunkSize;
+
+	// Initial shares in proportion to throughput: measured if every device
+	// has been measured, else nominal (measured and nominal values are not
+	// comparable, so they are not mixed).
+	std::vector<double> weight(nDevices);
+	bool allMeasured = true;
+	for (size_t d=0 ; d<nDevices ; d++)
+		allMeasured = allMeasured && (devStats[d].itemsPerSecond > 0.0);
+	double totalWeight = 0.0;
+	for (size_t d=0 ; d<nDevices ; d++)
+	{
+		weight[d] = allMeasured ? devStats[d].itemsPerSecond : devices[d]->nominalSpeed();
+		totalWeight += weight[d];
+	}
+	std::vector<ChunkRange> ranges(nDevices);
+	double cumulative = 0.0;
+	size_t first = 0;
+	for (size_t d=0 ; d<nDevices ; d++)
+	{
+		cumulative += weight[d];
+		size_t last = (d == nDevices-1) ? nChunks :
+			std::min(nChunks, static_cast<size_t>(nChunks * cumulative / totalWeight + 0.5));
+		ranges[d].next = first;
+		ranges[d].end = std::max(first, last);
+		first = ranges[d].end;
+	}
+	for (size_t d=0 ; d<nDevices ; d++)
+	{
+		devStats[d].items = devStats[d].chunks = devStats[d].stolenChunks = 0;
+		devStats[d].busySeconds = 0.0;
+	}
+
+	std::mutex rangeLock;
+	auto worker = [&](size_t d)
+	{
+		DeviceWorkStats& stats = devStats[d];
+		for (;;)
+		{
+			size_t c;
+			{
+				std::lock_guard<std::mutex> lock(rangeLock);
+				if ((ranges[d].remaining() == 0) && stealing)
+				{
+					// Take the back half of the largest remaining share
+					size_t victim = d;
+					for (size_t v=0 ; v<nDevices ; v++)
+						if (ranges[v].remaining() > ranges[victim].remaining())
+							victim = v;
+					size_t k = (ranges[victim].remaining() + 1) / 2;
+					if (k == 0)
+						break;
+					ranges[d].end = ranges[victim].end;
+					ranges[victim].end -= k;
+					ranges[d].next = ranges[victim].end;
+					stats.stolenChunks += k;
+				}
+				if (ranges[d].remaining() == 0)
+					break;
+				c = ranges[d].next++;
+			}
+			size_t begin = c * chunkSize;
+			size_t end = std::min(n, begin + chunkSize);
+			auto start = std::chrono::steady_clock::now();
+			f(*devices[d], d, begin, end);
+			std::chrono::duration<double> busy = std::chrono::steady_clock::now() - start;
+			stats.busySeconds += busy.count();
+			stats.items += end - begin;
+			stats.chunks++;
+		}
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+	for (size_t d=0 ; d<nDevices ; d++)
+		threads.push_back(std::thread(worker, d));
+	for (size_t d=0 ; d<nDevices ; d++)
+		threads[d].join();
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+	// Smooth over runs, so one noisy run does not swing the next split
+	for (size_t d=0 ; d<nDevices ; d++)
+		if ((devStats[d].items > 0) && (devStats[d].busySeconds > 0.0))
+		{
+			double rate = devStats[d].items / devStats[d].busySeconds;
+			double& estimate = devStats[d].itemsPerSecond;
+			estimate = (estimate > 0.0) ? 0.5 * (estimate + rate) : rate;
+		}
+	return elapsed.count();
+}
+
+void WorkScheduler::report(std::ostream& os) const
+{
+	size_t totalItems = 0;
+	for (size_t d=0 ; d<devices.size() ; d++)
+		totalItems += devStats[d].items;
+	for (size_t d=0 ; d<devices.size() ; d++)
+	{
+		const DeviceWorkStats& s = devStats[d];
+		os << "  " << d << ": " << devices[d]->name() << ": "
+		   << ((totalItems == 0) ? 0.0 : 100.0 * s.items / totalItems) << "% of the items, "
+		   << s.chunks << " chunks (" << s.stolenChunks << " stolen), busy "
+		   << (s.busySeconds * 1.0e3) << " ms, " << (s.itemsPerSecond * 1.0e-6) << " M items/s\n";
+	}
+}
@@ -0,0 +1,122 @@
+// MultiDevice.h: Split one problem across every device on every platform.
+//
+// OpenCLRuntime drives a single device. A ComputeDevice is the same idea
+// for one of many: its own context, queue, programs, and kernels, so each
+// device can be driven from its own host thread without sharing any
+// OpenCL object (clSetKernelArg on a shared kernel is not thread-safe).
+//
+// A WorkScheduler splits the range [0, n) into chunks and runs them on all
+// its devices at once, one host thread per device. Each device starts with
+// a contiguous run of chunks in proportion to its throughput (measured on
+// earlier runs of the same scheduler, or estimated from compute units times
+// clock rate before there are any). When a device runs out, it steals the
+// back half of the remaining chunks of the device with the most left, so a
+// device that is slower than its estimate does not hold everyone up.
+//
+// To try this on a machine with a single device, split the device with
+// clCreateSubDevices (discoverDevices' "subDevices"); pocl's CPU device,
+// for one, can be partitioned.
+
+#ifndef MULTIDEVICE_H
+#define MULTIDEVICE_H
+
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CLHandle.h"
+
+class ComputeDevice
+{
+public:
+	// Creates a context and an in-order queue for "dev" alone
+	ComputeDevice(cl_platform_id platform, DeviceHandle dev, const std::string& name);
+
+	cl_platform_id platform() const { return devPlatform; }
+	cl_device_id device() const { return dev; }
+	cl_context context() const { return ctx; }
+	cl_command_queue queue() const { return cmdQueue; }
+	// The device name, plus the sub-device number for sub-devices
+	const std::string& name() const { return devName; }
+	// Compute units times clock rate in MHz: the throughput estimate used
+	// before the device has been measured
+	double nominalSpeed() const;
+
+	// As OpenCLRuntime::program and OpenCLRuntime::kernel, but for this
+	// device. Call them from one thread at a time.
+	cl_program program(const std::string& fileName, const std::string& options = "");
+	cl_kernel kernel(const std::string& fileName, const std::string& kernelName,
+		const std::string& options = "");
+
+	MemHandle createBuffer(cl_mem_flags flags, size_t size, void* hostPtr = nullptr);
+
+private:
+	ComputeDevice(const ComputeDevice&) = delete;
+	ComputeDevice& operator=(const ComputeDevice&) = delete;
+
+	cl_platform_id devPlatform;
+	DeviceHandle dev;
+	std::string devName;
+	ContextHandle ctx;
+	QueueHandle cmdQueue;
+	// Keyed as in OpenCLRuntime
+	std::map<std::string, ProgramHandle> programs;
+	std::map<std::string, KernelHandle> kernels;
+};
+
+typedef std::vector<std::unique_ptr<ComputeDevice> > ComputeDevices;
+
+// Every device of the given type on every platform (that supports double
+// precision, if "requireFP64"). If "subDevices" > 1, each device that can
+// be partitioned is replaced by that many sub-devices with equal shares of
+// its compute units. $GPGPU_DEVICES, if set, keeps only the devices whose
+// name or platform name contains one of its comma-separated entries.
+ComputeDevices discoverDevices(cl_device_type desiredDeviceType, bool requireFP64, int subDevices = 0);
+
+// What one device did during (and over all) WorkScheduler::run calls
+struct DeviceWorkStats
+{
+	size_t items;         // during the last run
+	size_t chunks;
+	size_t stolenChunks;  // chunks taken from another device's share
+	double busySeconds;   // time spent in the chunk function
+	double itemsPerSecond; // measured throughput, smoothed over runs; 0: none yet
+
+	DeviceWorkStats() : items(0), chunks(0), stolenChunks(0), busySeconds(0.0), itemsPerSecond(0.0) {}
+};
+
+class WorkScheduler
+{
+public:
+	// Called on device "devIndex"'s thread for items [begin, end). It should
+	// return only when the results for those items are on the host (or
+	// wherever the caller wants them), so that the time it takes is the
+	// device's real cost.
+	typedef std::function<void(ComputeDevice& dev, size_t devIndex, size_t begin, size_t end)> ChunkFunction;
+
+	explicit WorkScheduler(const std::vector<ComputeDevice*>& devices);
+
+	// Runs "f" over [0, n) in chunks of "chunkSize" items (the last may be
+	// shorter), then updates the throughput estimates. Returns the elapsed
+	// time in seconds.
+	double run(size_t n, size_t chunkSize, const ChunkFunction& f);
+
+	// With stealing off, each device does exactly its initial share.
+	void setStealing(bool on) { stealing = on; }
+
+	size_t deviceCount() const { return devices.size(); }
+	const DeviceWorkStats& stats(size_t devIndex) const { return devStats[devIndex]; }
+	// One line per device: its share of the last run's items, chunks stolen,
+	// busy time, and throughput
+	void report(std::ostream& os = std::cout) const;
+
+private:
+	std::vector<ComputeDevice*> devices;
+	std::vector<DeviceWorkStats> devStats;
+	bool stealing;
+};
+
+#endif
@@ -0,0 +1,326 @@
+// OpenCLRuntime.c++: The OpenCL setup shared by all the examples.
+
+#include <iostream>
+#include <vector>
+#include <stdlib.h>
+#include <string.h>
+
+#include "OpenCLRuntime.h"
+#include "ProgramCache.h"
+
+bool debug = false;
+void checkStatus(std::string where, cl_int status, bool abortOnError)
+{
+	if (debug || (status != 0))
+		std::cout << "Step " << where << ", status = " << status << '\n';
+	if ((status != 0) && abortOnError)
+		exit(1);
+}
+
+void reportVersion(cl_platform_id platform)
+{
+	// Get the version of OpenCL supported on this platform
+	size_t strLength;
+	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, 0, nullptr, &strLength);
+	char* version = new char[strLength+1];
+	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, strLength+1, version, &strLength);
+	std::cout << version << '\n';
+	delete [] version;
+}
+
+void showProgramBuildLog(cl_program pgm, cl_device_id dev)
+{
+	size_t size;
+	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, 0, nullptr, &size);
+	char* log = new char[size+1];
+	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, size+1, log, nullptr);
+	std::cout << "LOG:\n" << log << "\n\n";
+	delete [] log;
+}
+
+void lookAtDeviceLimits(cl_device_id dev)
+{
+	cl_ulong gms;
+	clGetDeviceInfo(dev, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &gms, nullptr);
+	cl_ulong lms;
+	clGetDeviceInfo(dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &lms, nullptr);
+	size_t mwgs;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &mwgs, nullptr);
+	cl_uint maxCUs;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &maxCUs, nullptr);
+
+	std::cout << "Device global mem size:     " << gms << '\n';
+	std::cout << "Device local mem size:      " << lms << '\n';
+	std::cout << "Device max work group size: " << mwgs << '\n';
+	std::cout << "Device max compute units:   " << maxCUs << '\n';
+	std::cout << '\n';
+}
+
+KernelLimits getKernelLimits(cl_kernel kernel, cl_device_id dev)
+{
+	KernelLimits limits;
+	limits.localMemSize = -1;
+	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &limits.localMemSize, nullptr);
+	limits.privateMemSize = -1;
+	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &limits.privateMemSize, nullptr);
+	limits.preferredMultiple = -1;
+	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &limits.preferredMultiple, nullptr);
+	limits.maxWorkGroupSize = -1;
+	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &limits.maxWorkGroupSize, nullptr);
+	return limits;
+}
+
+void lookAtKernelLimits(cl_kernel kernel, cl_device_id dev)
+{
+	KernelLimits limits = getKernelLimits(kernel, dev);
+
+	std::cout << "Kernel local memory size:   " << limits.localMemSize << '\n';
+	std::cout << "Kernel private memory size: " << limits.privateMemSize << '\n';
+	std::cout << "Kernel warpSize:            " << limits.preferredMultiple << '\n';
+	std::cout << "Kernel max work group size: " << limits.maxWorkGroupSize << '\n';
+	std::cout << '\n';
+}
+
+// For string-valued queries like CL_DEVICE_NAME and CL_DRIVER_VERSION
+std::string getDeviceString(cl_device_id dev, cl_device_info param)
+{
+	size_t length = 0;
+	clGetDeviceInfo(dev, param, 0, nullptr, &length);
+	char* value = new char[length+1];
+	clGetDeviceInfo(dev, param, length+1, value, nullptr);
+	value[length] = '\0';
+	std::string result(value);
+	delete [] value;
+	return result;
+}
+
+bool deviceSupportsFP64(cl_device_id dev)
+{
+	return getDeviceString(dev, CL_DEVICE_EXTENSIONS).find("cl_khr_fp64") != std::string::npos;
+}
+
+std::string getPlatformString(cl_platform_id platform, cl_platform_info param)
+{
+	size_t length = 0;
+	clGetPlatformInfo(platform, param, 0, nullptr, &length);
+	char* value = new char[length+1];
+	clGetPlatformInfo(platform, param, length+1, value, nullptr);
+	value[length] = '\0';
+	std::string result(value);
+	delete [] value;
+	return result;
+}
+
+std::vector<PlatformDevice> findDevices(cl_device_type desiredDeviceType, bool requireFP64, bool* anyPlatform)
+{
+	std::vector<PlatformDevice> found;
+	cl_uint numPlatforms = 0;
+	cl_int status = clGetPlatformIDs(0, nullptr, &numPlatforms);
+	// With no OpenCL implementation installed, the ICD loader fails here
+	// (CL_PLATFORM_NOT_FOUND_KHR); callers then fall back to the host.
+	checkStatus("clGetPlatformIDs-0", status, false);
+	bool havePlatform = (status == CL_SUCCESS) && (numPlatforms > 0);
+	if (anyPlatform != nullptr)
+		*anyPlatform = havePlatform;
+	if (!havePlatform)
+	{
+		std::cout << "No platforms!\n";
+		return found;
+	}
+
+	std::vector<cl_platform_id> platforms(numPlatforms);
+	status = clGetPlatformIDs(numPlatforms, platforms.data(), nullptr);
+	checkStatus("clGetPlatformIDs-1", status, true);
+
+	for (cl_uint p=0 ; p<numPlatforms ; p++)
+	{
+		// A platform with no devices of the desired type is not an error
+		cl_uint numDevices = 0;
+		status = clGetDeviceIDs(platforms[p], desiredDeviceType, 0, nullptr, &numDevices);
+		if ((status == CL_DEVICE_NOT_FOUND) || (numDevices == 0))
+			continue;
+		checkStatus("clGetDeviceIDs-0", status, true);
+
+		std::vector<cl_device_id> devices(numDevices);
+		status = clGetDeviceIDs(platforms[p], desiredDeviceType, numDevices, devices.data(), nullptr);
+		checkStatus("clGetDeviceIDs-1", status, true);
+
+		// Weed out the devices that cannot run the caller's kernels
+		for (cl_uint idx=0 ; idx<numDevices ; idx++)
+			if (!requireFP64 || deviceSupportsFP64(devices[idx]))
+			{
+				PlatformDevice pd = { platforms[p], devices[idx] };
+				found.push_back(pd);
+			}
+	}
+	return found;
+}
+
+// Larger is better: the kind of device first, then its raw capacity
+static double devicePreference(cl_device_id dev)
+{
+	cl_device_type type = 0;
+	clGetDeviceInfo(dev, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+	cl_uint computeUnits = 1, clockMHz = 1;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, nullptr);
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(cl_uint), &clockMHz, nullptr);
+	double kind = (type & CL_DEVICE_TYPE_GPU) ? 3.0 : (type & CL_DEVICE_TYPE_ACCELERATOR) ? 2.0 :
+		(type & CL_DEVICE_TYPE_CPU) ? 1.0 : 0.0;
+	return kind * 1.0e12 + static_cast<double>(computeUnits) * clockMHz;
+}
+
+size_t selectDevice(const std::vector<PlatformDevice>& devices)
+{
+	const char* wanted = getenv("GPGPU_DEVICE");
+	if ((wanted != nullptr) && (wanted[0] != '\0'))
+	{
+		if (strspn(wanted, "0123456789") == strlen(wanted))
+		{
+			size_t idx = atol(wanted);
+			if (idx < devices.size())
+				return idx;
+			std::cout << "GPGPU_DEVICE=" << wanted << ", but there are only " << devices.size() << " devices\n";
+		}
+		else
+		{
+			for (size_t i=0 ; i<devices.size() ; i++)
+				if ((getDeviceString(devices[i].device, CL_DEVICE_NAME).find(wanted) != std::string::npos) ||
+				    (getPlatformString(devices[i].platform, CL_PLATFORM_NAME).find(wanted) != std::string::npos))
+					return i;
+			std::cout << "GPGPU_DEVICE=" << wanted << " matches no device\n";
+		}
+	}
+	size_t best = 0;
+	for (size_t i=1 ; i<devices.size() ; i++)
+		if (devicePreference(devices[i].device) > devicePreference(devices[best].device))
+			best = i;
+	return best;
+}
+
+OpenCLRuntime* OpenCLRuntime::get(cl_device_type desiredDeviceType, bool requireFP64)
+{
+	// Deliberately never deleted: the context, queue, programs, and kernels
+	// live as long as the process does. (Releasing them from a static
+	// destructor can run after the OpenCL implementation has been unloaded.)
+	static OpenCLRuntime* theRuntime = nullptr;
+	static bool initialized = false;
+	if (!initialized)
+	{
+		initialized = true;
+		OpenCLRuntime* rt = new OpenCLRuntime();
+		if (rt->typicalOpenCLProlog(desiredDeviceType, requireFP64))
+			theRuntime = rt;
+		else
+			delete rt;
+	}
+	return theRuntime;
+}
+
+// Typical OpenCL startup. Returns false if there is no usable device.
+bool OpenCLRuntime::typicalOpenCLProlog(cl_device_type desiredDeviceType, bool requireFP64)
+{
+	//-----------------------------------------------------
+	// Discover the platforms and their devices, and choose
+	// one device (without asking; see selectDevice)
+	//-----------------------------------------------------
+
+	if (requireFP64)
+		std::cout << "\nLooking for a device that supports double precision...\n";
+	bool anyPlatform = false;
+	std::vector<PlatformDevice> possibleDevs = findDevices(desiredDeviceType, requireFP64, &anyPlatform);
+	if (!anyPlatform)
+		return false; // findDevices has said so
+	if (possibleDevs.empty())
+	{
+		if (requireFP64)
+			std::cerr << "\nNo device supports double precision.\n";
+		else
+			std::cout << "No devices!\n";
+		return false;
+	}
+
+	size_t devIndex = selectDevice(possibleDevs);
+	if (possibleDevs.size() > 1)
+	{
+		for (size_t i=0 ; i<possibleDevs.size() ; i++)
+			std::cout << "Device " << i << ": " << getDeviceString(possibleDevs[i].device, CL_DEVICE_NAME)
+			          << " (" << getPlatformString(possibleDevs[i].platform, CL_PLATFORM_NAME) << ")\n";
+		std::cout << "Using device " << devIndex << " (set GPGPU_DEVICE to an index or a name to choose another)\n";
+	}
+	else
+		std::cout << "Only one device detected\n";
+	curPlatform = possibleDevs[devIndex].platform;
+	curDevice = possibleDevs[devIndex].device;
+
+	reportVersion(curPlatform);
+
+	//--------------------------------------------------
+	// Create a context for the one chosen device
+	//--------------------------------------------------
+
+	cl_int status;
+	ctx.reset(clCreateContext(nullptr, 1, &curDevice, nullptr, nullptr, &status));
+	checkStatus("clCreateContext", status, true);
+
+	//------------------------------------------------------------
+	// Create a command queue for the device in the context
+	// (There is one queue per device per context.)
+	//------------------------------------------------------------
+
+	cmdQueue.reset(clCreateCommandQueue(ctx, curDevice, 0, &status));
+	checkStatus("clCreateCommandQueue", status, true);
+
+	pool.reset(new BufferPool(ctx));
+
+	return true;
+}
+
+cl_program OpenCLRuntime::program(const std::string& fileName, const std::string& options)
+{
+	std::string key = fileName + '\n' + options;
+	std::map<std::string, ProgramHandle>::iterator it = programs.find(key);
+	if (it != programs.end())
+		return it->second;
+
+	// Compiled from source only if the on-disk cache has no usable binary
+	const char* source = readSource(fileName.c_str());
+	ProgramHandle pgm = buildProgramCached(ctx, curDevice, source, options);
+	free(const_cast<char*>(source));
+
+	programs[key] = pgm;
+	return pgm;
+}
+
+cl_kernel OpenCLRuntime::kernel(const std::string& fileName, const std::string& kernelName,
+	const std::string& options)
+{
+	std::string key = fileName + '\n' + options + '\n' + kernelName;
+	std::map<std::string, KernelHandle>::iterator it = kernels.find(key);
+	if (it != kernels.end())
+		return it->second;
+
+	cl_int status;
+	KernelHandle k(clCreateKernel(program(fileName, options), kernelName.c_str(), &status));
+	checkStatus("clCreateKernel-" + kernelName, status, true);
+
+	kernels[key] = k;
+	return k;
+}
+
+QueueHandle OpenCLRuntime::createQueue(cl_command_queue_properties properties)
+{
+	cl_int status;
+	QueueHandle q(clCreateCommandQueue(ctx, curDevice, properties, &status));
+	checkStatus("clCreateCommandQueue-extra", status, true);
+	return q;
+}
+
+MemHandle OpenCLRuntime::createBuffer(cl_mem_flags flags, size_t size, void* hostPtr)
+{
+	cl_int status;
+	MemHandle buf(clCreateBuffer(ctx, flags, size, hostPtr, &status));
+	checkStatus("clCreateBuffer", status, true);
+	allocationCounters.buffersCreated++;
+	allocationCounters.bytesCreated += size;
+	return buf;
+}
@@ -0,0 +1,115 @@
+// OpenCLRuntime.h: The OpenCL setup shared by all the examples.
+//
+// The examples used to each carry their own copy of checkStatus,
+// typicalOpenCLProlog, etc., and to create a context, command queue,
+// and program every time they launched a kernel. An OpenCLRuntime is
+// created once per process and owns the platform, device, context, and
+// queue from then on. Programs and kernels are built on first request
+// and cached, so repeated launches only pay for setting arguments and
+// enqueueing work.
+//
+// Kernel objects are shared by everyone asking for the same kernel, and
+// clSetKernelArg is not thread-safe, so use the runtime from one thread
+// (or serialize set-args-then-enqueue sequences yourself).
+
+#ifndef OPENCLRUNTIME_H
+#define OPENCLRUNTIME_H
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "CLHandle.h"
+#include "BufferPool.h"
+
+// A couple simple utility functions:
+extern bool debug;
+void checkStatus(std::string where, cl_int status, bool abortOnError = true);
+void reportVersion(cl_platform_id platform);
+void showProgramBuildLog(cl_program pgm, cl_device_id dev);
+void lookAtDeviceLimits(cl_device_id dev);
+void lookAtKernelLimits(cl_kernel kernel, cl_device_id dev);
+
+// What lookAtKernelLimits reports, for code that wants to use it
+struct KernelLimits
+{
+	cl_ulong localMemSize;     // __local memory the kernel itself uses
+	cl_ulong privateMemSize;
+	size_t preferredMultiple;  // CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE
+	size_t maxWorkGroupSize;   // CL_KERNEL_WORK_GROUP_SIZE
+};
+KernelLimits getKernelLimits(cl_kernel kernel, cl_device_id dev);
+
+std::string getDeviceString(cl_device_id dev, cl_device_info param);
+bool deviceSupportsFP64(cl_device_id dev);
+const char* readSource(const char* fileName);
+
+// Every device of the given type on every platform (that supports double
+// precision, if "requireFP64"), in platform order. If "anyPlatform" is
+// given, it is set to whether there is any OpenCL platform at all.
+struct PlatformDevice
+{
+	cl_platform_id platform;
+	cl_device_id device;
+};
+std::vector<PlatformDevice> findDevices(cl_device_type desiredDeviceType, bool requireFP64,
+	bool* anyPlatform = nullptr);
+// The index in "devices" of the one to use when only one is wanted:
+// $GPGPU_DEVICE if set (an index into "devices", or part of a device or
+// platform name); otherwise a GPU over an accelerator over a CPU, and then
+// the most compute units times clock rate. Never asks the user.
+size_t selectDevice(const std::vector<PlatformDevice>& devices);
+std::string getPlatformString(cl_platform_id platform, cl_platform_info param);
+
+class OpenCLRuntime
+{
+public:
+	// Returns the runtime for this process. The first call discovers the
+	// platforms and devices, selects one device (one that supports double
+	// precision if "requireFP64"; see selectDevice), and creates its context
+	// and queue. Later calls return the same runtime and ignore their
+	// arguments. Returns nullptr if no suitable device was found.
+	static OpenCLRuntime* get(cl_device_type desiredDeviceType = CL_DEVICE_TYPE_DEFAULT,
+		bool requireFP64 = false);
+
+	cl_platform_id platform() const { return curPlatform; }
+	cl_device_id device() const { return curDevice; }
+	cl_context context() const { return ctx; }
+	cl_command_queue queue() const { return cmdQueue; }
+	// Another queue on the same device and context, e.g., to overlap
+	// transfers with kernels. Kernels from kernel() can be enqueued on it.
+	QueueHandle createQueue(cl_command_queue_properties properties = 0);
+
+	// The program in "fileName" built with "options". Built on the first
+	// request (from the on-disk binary cache if possible; see ProgramCache.h);
+	// exits (after showing the build log) if it does not compile.
+	cl_program program(const std::string& fileName, const std::string& options = "");
+	// The "__kernel" function "kernelName" from program(fileName, options).
+	cl_kernel kernel(const std::string& fileName, const std::string& kernelName,
+		const std::string& options = "");
+
+	// A new buffer, released when the last handle to it goes away
+	MemHandle createBuffer(cl_mem_flags flags, size_t size, void* hostPtr = nullptr);
+	// Buffers that go back to a pool for reuse instead (see BufferPool.h)
+	BufferPool& bufferPool() { return *pool; }
+	PooledBuffer acquireBuffer(size_t size) { return pool->acquire(size); }
+
+private:
+	OpenCLRuntime() : curPlatform(nullptr), curDevice(nullptr) {}
+	OpenCLRuntime(const OpenCLRuntime&) = delete;
+	OpenCLRuntime& operator=(const OpenCLRuntime&) = delete;
+
+	bool typicalOpenCLProlog(cl_device_type desiredDeviceType, bool requireFP64);
+
+	cl_platform_id curPlatform;
+	cl_device_id curDevice;
+	ContextHandle ctx;
+	QueueHandle cmdQueue;
+	std::unique_ptr<BufferPool> pool;
+	// Keyed by fileName + '\n' + options (+ '\n' + kernelName for kernels)
+	std::map<std::string, ProgramHandle> programs;
+	std::map<std::string, KernelHandle> kernels;
+};
+
+#endif
@@ -0,0 +1,32 @@
+// Profiling.c++: Command timings from OpenCL events, and their statistics.
+
+#include <algorithm>
+
+#include "Profiling.h"
+#include "OpenCLRuntime.h"
+
+double profiledMilliseconds(cl_event ev)
+{
+	cl_ulong start = 0, end = 0;
+	cl_int status = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, nullptr);
+	checkStatus("clGetEventProfilingInfo-START", status, true);
+	status = clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, nullptr);
+	checkStatus("clGetEventProfilingInfo-END", status, true);
+	return (end - start) * 1.0e-6;
+}
+
+TimingSummary summarize(std::vector<double>& samples)
+{
+	TimingSummary s = { samples.size(), 0.0, 0.0, 0.0, 0.0 };
+	if (samples.empty())
+		return s;
+	std::sort(samples.begin(), samples.end());
+	double sum = 0.0;
+	for (size_t i=0 ; i<samples.size() ; i++)
+		sum += samples[i];
+	s.min = samples[0];
+	s.median = samples[samples.size()/2];
+	s.p99 = samples[(samples.size()*99)/100];
+	s.mean = sum / samples.size();
+	return s;
+}
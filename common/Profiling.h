@@ -0,0 +1,28 @@
+// Profiling.h: Command timings from OpenCL events, and their statistics.
+//
+// Queues only record timestamps if created with CL_QUEUE_PROFILING_ENABLE,
+// e.g., rt.createQueue(CL_QUEUE_PROFILING_ENABLE). The times are measured
+// by the device, from when the command starts executing until it ends, so
+// they exclude enqueue overhead and time spent waiting in the queue.
+
+#ifndef PROFILING_H
+#define PROFILING_H
+
+#include <vector>
+
+#include "CLHandle.h"
+
+// CL_PROFILING_COMMAND_END - CL_PROFILING_COMMAND_START, in milliseconds.
+// The command must be complete (e.g., after clWaitForEvents or clFinish).
+double profiledMilliseconds(cl_event ev);
+
+struct TimingSummary
+{
+	size_t count;
+	double min, median, p99, mean;
+};
+
+// Summarizes "samples" (in any unit; sorts them in place)
+TimingSummary summarize(std::vector<double>& samples);
+
+#endif
@@ -0,0 +1,249 @@
+// ProgramCache.c++: An on-disk cache of compiled OpenCL program binaries.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ProgramCache.h"
+#include "OpenCLRuntime.h"
+
+// Written at the start of every entry, followed by the full key (to guard
+// against hash collisions) and then the binary.
+static const char* entryMagic = "GPGPU-CLBIN 1";
+static const char* entrySuffix = ".clbin";
+
+// 64-bit FNV-1a: not cryptographic, but plenty to tell sources apart.
+static unsigned long long fnv1a(const std::string& s)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i=0 ; i<s.size() ; i++)
+	{
+		hash ^= static_cast<unsigned char>(s[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static std::string toHex(unsigned long long value)
+{
+	char buf[17];
+	snprintf(buf, sizeof(buf), "%016llx", value);
+	return buf;
+}
+
+bool makeDirectories(const std::string& path)
+{
+	for (size_t pos=1 ; pos<=path.size() ; pos++)
+		if ((pos == path.size()) || (path[pos] == '/'))
+		{
+			std::string prefix = path.substr(0, pos);
+			if ((mkdir(prefix.c_str(), 0755) != 0) && (errno != EEXIST))
+				return false;
+		}
+	return true;
+}
+
+std::string programCacheDirectory()
+{
+	const char* dir = getenv("GPGPU_PROGRAM_CACHE");
+	if (dir != nullptr)
+		return (strcmp(dir, "off") == 0) ? "" : dir;
+	return userCacheDirectory();
+}
+
+std::string userCacheDirectory()
+{
+	const char* xdg = getenv("XDG_CACHE_HOME");
+	if ((xdg != nullptr) && (xdg[0] != '\0'))
+		return std::string(xdg) + "/GPGPU_Examples";
+	const char* home = getenv("HOME");
+	if ((home != nullptr) && (home[0] != '\0'))
+		return std::string(home) + "/.cache/GPGPU_Examples";
+	return "";
+}
+
+static std::string cacheKey(cl_device_id dev, const std::string& source, const std::string& options)
+{
+	std::ostringstream key;
+	key << "source=" << toHex(fnv1a(source)) << ':' << source.size() << '\n'
+	    << "device=" << getDeviceString(dev, CL_DEVICE_NAME) << '\n'
+	    << "deviceVersion=" << getDeviceString(dev, CL_DEVICE_VERSION) << '\n'
+	    << "driverVersion=" << getDeviceString(dev, CL_DRIVER_VERSION) << '\n'
+	    << "options=" << options << '\n';
+	return key.str();
+}
+
+static std::string entryPath(const std::string& dir, const std::string& key)
+{
+	return dir + '/' + toHex(fnv1a(key)) + entrySuffix;
+}
+
+// Returns false (leaving "binary" empty) on a miss, including when the
+// entry is unreadable or belongs to some other key.
+static bool readEntry(const std::string& path, const std::string& key, std::vector<unsigned char>& binary)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	if (!in)
+		return false;
+	std::string magic;
+	size_t keyLength = 0, binaryLength = 0;
+	if (!std::getline(in, magic) || (magic != entryMagic) || !(in >> keyLength) || (in.get() != '\n'))
+		return false;
+	std::string storedKey(keyLength, '\0');
+	if (!in.read(&storedKey[0], keyLength) || (storedKey != key))
+		return false;
+	if (!(in >> binaryLength) || (in.get() != '\n') || (binaryLength == 0))
+		return false;
+	binary.resize(binaryLength);
+	if (!in.read(reinterpret_cast<char*>(binary.data()), binaryLength))
+	{
+		binary.clear();
+		return false;
+	}
+	return true;
+}
+
+// Write to a file private to this process, then rename it into place:
+// rename is atomic, so readers see either no entry or a complete one.
+static void writeEntry(const std::string& dir, const std::string& path, const std::string& key,
+	const std::vector<unsigned char>& binary)
+{
+	if (!makeDirectories(dir))
+	{
+		if (debug)
+			std::cout << "Program cache: cannot create " << dir << '\n';
+		return;
+	}
+	// Atomic: threads driving different devices may build programs at once
+	static std::atomic<int> counter(0);
+	std::string tmpPath = path + ".tmp." + std::to_string(getpid()) + '.' + std::to_string(counter++);
+	{
+		std::ofstream out(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+		out << entryMagic << '\n' << key.size() << '\n' << key
+		    << binary.size() << '\n';
+		out.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+		if (!out.flush())
+		{
+			out.close();
+			unlink(tmpPath.c_str());
+			return;
+		}
+	}
+	if (rename(tmpPath.c_str(), path.c_str()) != 0)
+		unlink(tmpPath.c_str());
+}
+
+static bool getProgramBinary(cl_program pgm, std::vector<unsigned char>& binary)
+{
+	// The program was built for exactly one device, so there is one binary
+	size_t size = 0;
+	cl_int status = clGetProgramInfo(pgm, CL_PROGRAM_BINARY_SIZES, sizeof(size_t), &size, nullptr);
+	if ((status != CL_SUCCESS) || (size == 0))
+		return false;
+	binary.resize(size);
+	unsigned char* binaries[] = { binary.data() };
+	status = clGetProgramInfo(pgm, CL_PROGRAM_BINARIES, sizeof(binaries), binaries, nullptr);
+	return status == CL_SUCCESS;
+}
+
+ProgramHandle buildProgramCached(cl_context ctx, cl_device_id dev,
+	const std::string& source, const std::string& options, bool* cacheHit)
+{
+	if (cacheHit != nullptr)
+		*cacheHit = false;
+	std::string dir = programCacheDirectory();
+	std::string key, path;
+	cl_int status;
+
+	if (!dir.empty())
+	{
+		key = cacheKey(dev, source, options);
+		path = entryPath(dir, key);
+		std::vector<unsigned char> binary;
+		if (readEntry(path, key, binary))
+		{
+			const unsigned char* binaries[] = { binary.data() };
+			size_t length = binary.size();
+			cl_int binaryStatus;
+			ProgramHandle pgm(clCreateProgramWithBinary(ctx, 1, &dev, &length, binaries,
+				&binaryStatus, &status));
+			if ((status == CL_SUCCESS) && (binaryStatus == CL_SUCCESS))
+				status = clBuildProgram(pgm, 1, &dev, options.c_str(), nullptr, nullptr);
+			if ((status == CL_SUCCESS) && (binaryStatus == CL_SUCCESS))
+			{
+				if (debug)
+					std::cout << "Program cache: hit " << path << '\n';
+				if (cacheHit != nullptr)
+					*cacheHit = true;
+				return pgm;
+			}
+			// A stale or corrupt entry: drop it and build from source
+			if (debug)
+				std::cout << "Program cache: unusable entry " << path << ", status = " << status << '\n';
+			unlink(path.c_str());
+		}
+	}
+
+	//-----------------------------------------------------
+	// Create, compile, and link the program
+	//-----------------------------------------------------
+
+	const char* programSource[] = { source.c_str() };
+	ProgramHandle pgm(clCreateProgramWithSource(ctx,
+		1, programSource, nullptr, &status));
+	checkStatus("clCreateProgramWithSource", status, true);
+
+	status = clBuildProgram(pgm, 1, &dev, options.c_str(), nullptr, nullptr);
+	checkStatus("clBuildProgram", status, false);
+	if (status != 0)
+	{
+		showProgramBuildLog(pgm, dev);
+		exit(1);
+	}
+
+	std::vector<unsigned char> binary;
+	if (!dir.empty() && getProgramBinary(pgm, binary))
+		writeEntry(dir, path, key, binary);
+	return pgm;
+}
+
+bool invalidateCachedProgram(cl_device_id dev, const std::string& source, const std::string& options)
+{
+	std::string dir = programCacheDirectory();
+	if (dir.empty())
+		return false;
+	return unlink(entryPath(dir, cacheKey(dev, source, options)).c_str()) == 0;
+}
+
+int clearProgramCache()
+{
+	std::string dir = programCacheDirectory();
+	if (dir.empty())
+		return 0;
+	DIR* d = opendir(dir.c_str());
+	if (d == nullptr)
+		return 0;
+	// Also sweeps up temporary files left by processes that died mid-write
+	std::vector<std::string> victims;
+	while (struct dirent* entry = readdir(d))
+	{
+		std::string name = entry->d_name;
+		if (name.find(entrySuffix) != std::string::npos)
+			victims.push_back(dir + '/' + name);
+	}
+	closedir(d);
+	int nRemoved = 0;
+	for (size_t i=0 ; i<victims.size() ; i++)
+		if (unlink(victims[i].c_str()) == 0)
+			nRemoved++;
+	return nRemoved;
+}
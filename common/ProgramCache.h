@@ -0,0 +1,49 @@
+// ProgramCache.h: An on-disk cache of compiled OpenCL program binaries.
+//
+// Building a program from source can take hundreds of milliseconds on
+// some implementations (e.g., pocl compiles through LLVM every time).
+// After a program is built from source, its binary (CL_PROGRAM_BINARIES)
+// is saved in the cache directory, and later builds of the same program
+// use clCreateProgramWithBinary instead.
+//
+// Entries are keyed by a hash of the source text, the device name, the
+// device and driver versions, and the build options, so editing a ".cl"
+// file, changing options, or updating the driver simply misses the cache.
+// Entries are written to a temporary file and renamed into place, so
+// concurrent processes sharing the directory never see partial entries.
+//
+// The cache directory is $GPGPU_PROGRAM_CACHE if that is set (set it to
+// "off" to disable caching), else $XDG_CACHE_HOME/GPGPU_Examples, else
+// $HOME/.cache/GPGPU_Examples.
+
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <string>
+
+#include "CLHandle.h"
+
+// The cache directory; empty if caching is disabled.
+std::string programCacheDirectory();
+
+// $XDG_CACHE_HOME/GPGPU_Examples or $HOME/.cache/GPGPU_Examples (empty if
+// neither variable is set): the default home of per-user files like this
+// cache and the autotuner's tuning file.
+std::string userCacheDirectory();
+// mkdir -p; returns false if some directory could not be created.
+bool makeDirectories(const std::string& path);
+
+// Build the program from "source" for "dev" with the given options, using
+// the cached binary if there is one (and storing it if not). Exits, after
+// showing the build log, if the source does not compile. If "cacheHit" is
+// not null, it is set to whether the binary came from the cache.
+ProgramHandle buildProgramCached(cl_context ctx, cl_device_id dev,
+	const std::string& source, const std::string& options, bool* cacheHit = nullptr);
+
+// Remove the cache entry for one program; returns whether there was one.
+bool invalidateCachedProgram(cl_device_id dev, const std::string& source, const std::string& options);
+
+// Remove every entry in the cache directory; returns the number removed.
+int clearProgramCache();
+
+#endif
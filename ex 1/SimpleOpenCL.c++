@@ -5,32 +5,138 @@
 //                   environment and prepare discovered devices to
 //                   execute code.
 //
-// All the code is in "main" - a terrible structure from a software
-// engineering perspective, but done to emphasize the required flow
-// of the program. An OpenCL program ought to be structured using,
-// for example, good OOD practices and modularity to get reusable
-// modules.
+// The OpenCL steps are in "vecaddOnDevice" to emphasize the required
+// flow. Steps 1-6 (discovering the platform and device, creating the
+// context and queue, and building the program) are the same in every
+// OpenCL program, so they are done by the OpenCLRuntime shared by all
+// the examples; see common/OpenCLRuntime.c++ for the details of each
+// step. With no OpenCL platform (or $GPGPU_BACKEND=host), "main"
+// computes the same table on the host instead; see common/HostCompute.h.
+// With -tune, the work-group sizes the kernel can use are timed and the
+// fastest is saved for later runs; see common/Autotuner.h.
 
 #include <iostream>
 #include <string>
 #include <string.h>
 #include <math.h>
+#include <chrono>
 
-#ifdef __APPLE__
-#include <OpenCL/opencl.h>
-#else
-#include <CL/opencl.h>
-#endif
+#include "Autotuner.h"
+#include "HostCompute.h"
+#include "OpenCLRuntime.h"
 
-const char* readSource(const char* fileName);
+static const int NUM_ELEMENTS = 16384;
+static const char* tuningKey = "SimpleOpenCL.cl:vecadd";
 
-bool debug = false;
-void checkStatus(std::string where, cl_int status)
+// C[2*i] = cos(A[i]), C[2*i+1] = sin(B[i]) with SimpleOpenCL.cl's vecadd.
+// With "tune", first finds (and saves) the fastest work-group size.
+void vecaddOnDevice(OpenCLRuntime* rt, const float* A, const float* B, float* C, bool tune)
 {
-	if (debug || (status != 0))
-		std::cout << "Step " << where << ", status = " << status << '\n';
-	if (status != 0)
-		exit(1);
+	cl_command_queue cmdQueue = rt->queue();
+
+	// ----------------------------------------------------
+	// STEP 5: Create and compile the program
+	// STEP 6: Create the CPU-side kernel reference
+	// ----------------------------------------------------
+
+	cl_kernel kernel = rt->kernel("SimpleOpenCL.cl", "vecadd");
+
+	// ******************************************************************
+	// ******************************************************************
+	// ******** The corresponding cpu-side CUDA processing would ********
+	// ******** start roughly here.                              ********
+	// ******************************************************************
+	// ******************************************************************
+
+	// ---------------------------------------------------------------------
+	// STEP 7: Create device buffers (shared by all devices in a context;
+	//         not initially guaranteed to be on any device in the context.)
+	// ---------------------------------------------------------------------
+
+	size_t datasize = NUM_ELEMENTS * sizeof(float);
+
+	MemHandle bufferA = rt->createBuffer(CL_MEM_READ_ONLY, datasize);    // Input array on the device
+	MemHandle bufferB = rt->createBuffer(CL_MEM_READ_ONLY, datasize);    // Input array on the device
+	MemHandle bufferC = rt->createBuffer(CL_MEM_WRITE_ONLY, 2*datasize); // Output array on the device
+	
+	// ----------------------------------------------------
+	// STEP 8: Write host data to device buffers
+	// ----------------------------------------------------
+	
+	cl_int status = clEnqueueWriteBuffer(cmdQueue, 
+		bufferA, CL_FALSE, 0, datasize,						 
+		A, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-A", status);
+	
+	status = clEnqueueWriteBuffer(cmdQueue, 
+		bufferB, CL_FALSE, 0, datasize,								  
+		B, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-B", status);
+
+	// ----------------------------------------------------
+	// STEP 9: Set the kernel arguments
+	// ----------------------------------------------------
+	
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufferA.get());
+	checkStatus("clSetKernelArg-0", status);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufferB.get());
+	checkStatus("clSetKernelArg-1", status);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufferC.get());
+	checkStatus("clSetKernelArg-2", status);
+	int n = NUM_ELEMENTS;
+	status = clSetKernelArg(kernel, 3, sizeof(int), &n);
+	checkStatus("clSetKernelArg-3", status);
+
+	// ----------------------------------------------------
+	// STEP 10: Configure the work-item structure: the work-group
+	//          size saved by -tune, if there is one (else the
+	//          implementation chooses). The global size is rounded
+	//          up to a multiple of it; the kernel skips the extras.
+	// ----------------------------------------------------
+
+	LaunchConfig config;
+	if (tune)
+		config = autotune(rt->device(), tuningKey, NUM_ELEMENTS, candidateLocalSizes(kernel, rt->device(), 1),
+			[&](const LaunchConfig& candidate)
+			{
+				// Best of 5 launches, after one warm-up launch
+				size_t global = roundUpGlobal(NUM_ELEMENTS, candidate.local[0]);
+				double best = -1.0;
+				for (int rep=0 ; rep<=5 ; rep++)
+				{
+					auto start = std::chrono::steady_clock::now();
+					cl_int s = clEnqueueNDRangeKernel(cmdQueue, kernel, 1, nullptr, &global,
+						candidate.localWorkSize(), 0, nullptr, nullptr);
+					if (s != CL_SUCCESS)
+						return -1.0;
+					clFinish(cmdQueue);
+					std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+					if ((rep > 0) && ((best < 0.0) || (elapsed.count() < best)))
+						best = elapsed.count();
+				}
+				return best;
+			});
+	else
+		findTunedConfig(rt->device(), tuningKey, NUM_ELEMENTS, config);
+	size_t globalWorkSize[1] = { roundUpGlobal(NUM_ELEMENTS, config.local[0]) };
+
+	// ----------------------------------------------------
+	// STEP 11: Enqueue the kernel for execution
+	// ----------------------------------------------------
+	
+	status = clEnqueueNDRangeKernel(cmdQueue, 
+		kernel, 1, nullptr, globalWorkSize, 
+		config.localWorkSize(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueNDRangeKernel", status);
+
+	// ----------------------------------------------------
+	// STEP 12: Read the output buffer back to the host
+	// ----------------------------------------------------
+	
+	status = clEnqueueReadBuffer(cmdQueue, 
+		bufferC, CL_TRUE, 0, 2*datasize, 
+		C, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status);
 }
 
 int main(int argc, char* argv[])
@@ -38,12 +144,15 @@ int main(int argc, char* argv[])
 	// OPTIONAL: Look for command line arguments that specify the
 	//		   types of devices for which I might want to look.
 	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	bool tune = false;
 	if (argc > 1)
 	{
 		for (int i=1 ; i<argc ; i++)
 		{
 			if (strcmp("-debug", argv[i]) == 0)
 				debug = true;
+			else if (strcmp("-tune", argv[i]) == 0)
+				tune = true;
 			else if (argv[i][0] == '-')
 			{
 				switch (argv[i][1])
@@ -69,7 +178,6 @@ int main(int argc, char* argv[])
 	//	C[2*i]   = cos(A[i]);
 	//	C[2*i+1] = sin(B[i]);
 	
-	const int NUM_ELEMENTS = 16384;   
 	// Allocate storage for the arrays A and B:
 	float *A = new float[NUM_ELEMENTS];	 // Input array
 	float *B = new float[NUM_ELEMENTS];	 // Input array
@@ -96,158 +204,42 @@ int main(int argc, char* argv[])
 	 * some of these steps in a different order for a variety of reasons.
 	 */
 
-	// ----------------------------------------------------
-	// STEP 1: Discover and initialize the platforms
-	// ----------------------------------------------------
-	
-	cl_uint numPlatforms = 0;
-	cl_int status = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	checkStatus("clGetPlatformIDs-0", status);
- 
-	cl_platform_id* platforms = new cl_platform_id[numPlatforms];
- 
-	status = clGetPlatformIDs(numPlatforms, platforms, nullptr);
-	checkStatus("clGetPlatformIDs-1", status);
-
-	// ------------------------------------------------------------------
-	// STEP 2: Discover and initialize the devices on a specific platform
-	//         Here we arbitrarily use platforms[0], which is probably
-	//         the only one.
-	// ------------------------------------------------------------------
-	
-	cl_uint numDevices = 0;
-	// See the code parsing argc-argv above for "devType"
-	status = clGetDeviceIDs(platforms[0], devType, 0, nullptr, &numDevices);
-	checkStatus("clGetDeviceIDs-0", status);
-
-	cl_device_id* devices = new cl_device_id[numDevices];
-
-	status = clGetDeviceIDs(platforms[0], devType, numDevices, devices, nullptr);
-	checkStatus("clGetDeviceIDs-1", status);
-
-	// ------------------------------------------------------------------------------
-	// STEP 3: Create a context for one or more devices. Here we arbitrarily
-	//         create a context containing all devices found in STEP 2.
-	//         (Alternatively, could just include one or more select devices.)
+	// ----------------------------------------------------------------
+	// STEPS 1-4: Discover and initialize the platforms and devices,
+	//            then create a context and a command queue for the
+	//            chosen device.
 	//
 	//         Contexts manage portions of the OpenCL state. Most notably for
 	//         now, buffers are created in a context (see STEP 7 below) and are
-	//         accessible to all devices belonging to that context.
-	//
-	// ALSO NOTE: A device can belong to more than one context, however a device
-	//            command queue (see STEP 4) is associated with exactly one device,
-	//            and it belongs to exactly one context. Event synchronization (an
-	//            advanced topic we will study later) is only possible between
-	//            queues belonging to the same context.
-	// ------------------------------------------------------------------------------
-	
-	cl_context context = clCreateContext(nullptr, numDevices, devices,
-		nullptr, nullptr, &status);
-	checkStatus("clCreateContext", status);
-
-	// --------------------------------------------------------------
-	// STEP 4: Create a command queue (must explicitly create a queue
-	//         for each desired device)
-	// --------------------------------------------------------------
-	
-	cl_command_queue cmdQueue = clCreateCommandQueue(context, devices[0], 
-		0, &status);
-	checkStatus("clCreateCommandQueue", status);
-
-	// ----------------------------------------------------
-	// STEP 5: Create and compile the program
-	// ----------------------------------------------------
-	 
-	const char* programSource[] = { readSource("SimpleOpenCL.cl") };
-	cl_program program = clCreateProgramWithSource(context, 
-		1, programSource, nullptr, &status);
-	checkStatus("clCreateProgramWithSource", status);
-
-	status = clBuildProgram(program, numDevices, devices, 
-		nullptr, nullptr, nullptr);
-	checkStatus("clBuildProgram", status);
-   
-	// ----------------------------------------------------
-	// STEP 6: Create the CPU-side kernel reference
-	// ----------------------------------------------------
-
-	cl_kernel kernel = clCreateKernel(program, "vecadd", &status);
-	checkStatus("clCreateKernel", status);
-
-	// ******************************************************************
-	// ******************************************************************
-	// ******** The corresponding cpu-side CUDA processing would ********
-	// ******** start roughly here.                              ********
-	// ******************************************************************
-	// ******************************************************************
-
-	// ---------------------------------------------------------------------
-	// STEP 7: Create device buffers (shared by all devices in a context;
-	//         not initially guaranteed to be on any device in the context.)
-	// ---------------------------------------------------------------------
+	//         accessible to all devices belonging to that context. A command
+	//         queue is associated with exactly one device, and it belongs to
+	//         exactly one context.
+	// ----------------------------------------------------------------
 
+	// A table this small may be faster on the host than the launch and the
+	// transfers; preferHost decides (or $GPGPU_BACKEND). A run that asked
+	// for a device with -a/-c/-g or -tune is never quietly run on the host.
 	size_t datasize = NUM_ELEMENTS * sizeof(float);
-
-	cl_mem bufferA = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-A", status);
-
-	cl_mem bufferB = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-B", status);
-
-	cl_mem bufferC = clCreateBuffer( // Output array on the device
-		context, CL_MEM_WRITE_ONLY, 2*datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-C", status);
-	
-	// ----------------------------------------------------
-	// STEP 8: Write host data to device buffers
-	// ----------------------------------------------------
-	
-	status = clEnqueueWriteBuffer(cmdQueue, 
-		bufferA, CL_FALSE, 0, datasize,						 
-		A, 0, nullptr, nullptr);
-	checkStatus("clEnqueueWriteBuffer-A", status);
-	
-	status = clEnqueueWriteBuffer(cmdQueue, 
-		bufferB, CL_FALSE, 0, datasize,								  
-		B, 0, nullptr, nullptr);
-	checkStatus("clEnqueueWriteBuffer-B", status);
-
-	// ----------------------------------------------------
-	// STEP 9: Set the kernel arguments
-	// ----------------------------------------------------
-	
-	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &bufferA);
-	checkStatus("clSetKernelArg-0", status);
-	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufferB);
-	checkStatus("clSetKernelArg-1", status);
-	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufferC);
-	checkStatus("clSetKernelArg-2", status);
-
-	// ----------------------------------------------------
-	// STEP 10: Configure the work-item structure
-	// ----------------------------------------------------
-	
-	size_t globalWorkSize[1] = { NUM_ELEMENTS };	
-
-	// ----------------------------------------------------
-	// STEP 11: Enqueue the kernel for execution
-	// ----------------------------------------------------
-	
-	status = clEnqueueNDRangeKernel(cmdQueue, 
-		kernel, 1, nullptr, globalWorkSize, 
-		nullptr, 0, nullptr, nullptr);
-	checkStatus("clEnqueueNDRangeKernel", status);
-
-	// ----------------------------------------------------
-	// STEP 12: Read the output buffer back to the host
-	// ----------------------------------------------------
-	
-	status = clEnqueueReadBuffer(cmdQueue, 
-		bufferC, CL_TRUE, 0, 2*datasize, 
-		C, 0, nullptr, nullptr);
-	checkStatus("clEnqueueReadBuffer", status);
+	bool plain = (devType == CL_DEVICE_TYPE_DEFAULT) && !tune;
+	OpenCLRuntime* rt = nullptr;
+	if (!plain || !preferHost(4.0 * datasize, 40.0 * NUM_ELEMENTS))
+		rt = OpenCLRuntime::get(devType);
+	if ((rt == nullptr) && !plain)
+	{
+		std::cerr << "-tune and -a/-c/-g need an OpenCL device\n";
+		delete [] A;
+		delete [] B;
+		delete [] C;
+		return 1;
+	}
+	if (rt != nullptr)
+		vecaddOnDevice(rt, A, B, C, tune);
+	else
+	{
+		std::cout << "Computing on the host (" << hostSimdName(hostSimdLevel()) << ", "
+		          << ThreadPool::get().size() << " threads)\n";
+		hostVecaddTrig(A, B, C, NUM_ELEMENTS);
+	}
 
 	// Sanity Check: Did I get expected results?`
 	int nDiffs = 0;
@@ -279,21 +271,14 @@ int main(int argc, char* argv[])
 	// STEP 13: Release OpenCL resources
 	// ----------------------------------------------------
 	
-	// Free OpenCL resources
-	clReleaseKernel(kernel);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(cmdQueue);
-	clReleaseMemObject(bufferA);
-	clReleaseMemObject(bufferB);
-	clReleaseMemObject(bufferC);
-	clReleaseContext(context);
+	// The buffers are released as their handles go out of scope. The
+	// kernel, program, queue, and context belong to the runtime and live
+	// as long as the process does.
 
 	// Free host resources
 	delete [] A;
 	delete [] B;
 	delete [] C;
-	delete [] platforms;
-	delete [] devices;
 
 	return 0;
 }
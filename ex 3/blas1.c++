@@ -0,0 +1,588 @@
+// This program runs the BLAS level 1 kernels in blas1.cl (axpy, scal, dot,
+// nrm2, and a fused axpby + dot) in single, double, and mixed precision.
+// Each result is checked against a host reference (computed in long
+// double), and the time of each kernel is compared with the
+// one-element-per-work-item saxpy.cl and daxpy.cl kernels.
+//
+// "Mixed" computes in float but accumulates sums in double, or, on devices
+// without cl_khr_fp64 (or with -floatfloat), in pairs of floats.
+//
+// Usage: blas1 [-a|-c|-g] [-single] [-double] [-mixed] [-floatfloat]
+//              [-sizes=<n>,...] [-local=<size>] [-groups=<count>] [-reps=<count>]
+//
+// With none of -single, -double, and -mixed, all three are run. Timings are
+// for the largest size. Exits with 1 if any result is out of tolerance, or
+// if there is no device to check.
+
+// System includes
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <limits.h>
+#include <vector>
+#include <algorithm>
+
+// OpenCL includes
+#include "OpenCLRuntime.h"
+#include "Profiling.h"
+
+enum Precision
+{
+	SINGLE, // float data, float sums
+	DOUBLE, // double data, double sums
+	MIXED   // float data, double (or float-float) sums
+};
+
+// The blas1.cl kernels for float or double data. Every operation runs on
+// "cmdQueue" (which must have profiling enabled), waits for its kernels,
+// and leaves their device time in lastMilliseconds.
+template <typename T>
+class Blas1
+{
+public:
+	Blas1(OpenCLRuntime& rt, cl_command_queue cmdQueue, Precision precision, bool useFloatFloat,
+		size_t localSize, size_t maxGroups);
+
+	void axpy(T a, cl_mem X, cl_mem Y, size_t n);
+	void scal(T a, cl_mem X, size_t n);
+	double dot(cl_mem X, cl_mem Y, size_t n);
+	double nrm2(cl_mem X, size_t n);
+	double axpbyDot(T a, cl_mem X, T b, cl_mem Y, cl_mem Z, size_t n);
+
+	// How the sums are accumulated, e.g., "double"
+	const std::string& accumulator() const { return accName; }
+	// The relative rounding error of one addition to a sum
+	double accumulatorEpsilon() const { return accEpsilon; }
+	size_t localSize() const { return local; }
+	size_t groups(size_t n) const;
+	cl_command_queue queue() const { return cmdQueue; }
+
+	double lastMilliseconds;
+
+private:
+	cl_kernel kernel(const char* name) { return rt.kernel("blas1.cl", name, options); }
+	void launch(cl_kernel k, size_t global, size_t local, const char* what);
+	double finishReduction(cl_kernel partialsKernel, cl_uint partialsArg, size_t n);
+
+	OpenCLRuntime& rt;
+	cl_command_queue cmdQueue;
+	std::string options, accName;
+	size_t accSize; // sizeof an accumulator in blas1.cl
+	double accEpsilon;
+	size_t local, maxGroups;
+	bool floatFloat;
+	PooledBuffer partials, result;
+};
+
+template <typename T>
+Blas1<T>::Blas1(OpenCLRuntime& rt, cl_command_queue cmdQueue, Precision precision, bool useFloatFloat,
+	size_t localSize, size_t maxGroups) :
+	lastMilliseconds(0.0), rt(rt), cmdQueue(cmdQueue), local(localSize), maxGroups(maxGroups),
+	floatFloat(false)
+{
+	if (precision == DOUBLE)
+	{
+		options = "-DREAL_IS_DOUBLE";
+		accName = "double";
+		accSize = sizeof(double);
+		accEpsilon = DBL_EPSILON;
+	}
+	else if ((precision == MIXED) && useFloatFloat)
+	{
+		options = "-DACCUM_FLOAT_FLOAT";
+		accName = "float-float";
+		accSize = 2 * sizeof(float);
+		// Not quite FLT_EPSILON^2: the renormalization can lose a bit or two
+		accEpsilon = 4.0 * FLT_EPSILON * FLT_EPSILON;
+		floatFloat = true;
+	}
+	else if (precision == MIXED)
+	{
+		options = "-DACCUM_DOUBLE";
+		accName = "double";
+		accSize = sizeof(double);
+		accEpsilon = DBL_EPSILON;
+	}
+	else
+	{
+		accName = "float";
+		accSize = sizeof(float);
+		accEpsilon = FLT_EPSILON;
+	}
+
+	// The tree reductions need a power of two that every kernel can use
+	const char* names[] = { "axpy", "scal", "dotPartials", "nrm2Partials", "axpbyDotPartials", "reducePartials" };
+	for (int i=0 ; i<6 ; i++)
+		local = std::min(local, getKernelLimits(kernel(names[i]), rt.device()).maxWorkGroupSize);
+	size_t powerOfTwo = 1;
+	while (2*powerOfTwo <= local)
+		powerOfTwo *= 2;
+	local = powerOfTwo;
+
+	partials = rt.acquireBuffer(maxGroups * accSize);
+	result = rt.acquireBuffer(accSize);
+}
+
+// Enough work-groups to cover n (in vectors of blas1.cl's width), up to
+// maxGroups; the grid-stride loops take care of the rest.
+template <typename T>
+size_t Blas1<T>::groups(size_t n) const
+{
+	size_t vectors = std::max<size_t>(n / (16 / sizeof(T)), 1);
+	return std::min((vectors + local - 1) / local, maxGroups);
+}
+
+template <typename T>
+void Blas1<T>::launch(cl_kernel k, size_t global, size_t local, const char* what)
+{
+	size_t globalWorkSize[] = { global };
+	size_t localWorkSize[] = { local };
+	cl_event ev;
+	cl_int status = clEnqueueNDRangeKernel(cmdQueue,
+		k, 1, nullptr, globalWorkSize,
+		localWorkSize, 0, nullptr, &ev);
+	checkStatus(std::string("clEnqueueNDRangeKernel-") + what, status, true);
+	EventHandle done(ev);
+	clWaitForEvents(1, &ev);
+	lastMilliseconds += profiledMilliseconds(ev);
+}
+
+template <typename T>
+void Blas1<T>::axpy(T a, cl_mem X, cl_mem Y, size_t n)
+{
+	cl_kernel k = kernel("axpy");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(T), &a);
+	status |= clSetKernelArg(k, 1, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 2, sizeof(cl_mem), &Y);
+	status |= clSetKernelArg(k, 3, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-axpy", status, true);
+	lastMilliseconds = 0.0;
+	launch(k, groups(n) * local, local, "axpy");
+}
+
+template <typename T>
+void Blas1<T>::scal(T a, cl_mem X, size_t n)
+{
+	cl_kernel k = kernel("scal");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(T), &a);
+	status |= clSetKernelArg(k, 1, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 2, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-scal", status, true);
+	lastMilliseconds = 0.0;
+	launch(k, groups(n) * local, local, "scal");
+}
+
+// Runs "partialsKernel" (whose arguments "partialsArg" and "partialsArg"+1,
+// the partial sums and the __local scratch space, are set here) and then
+// reducePartials, and returns the sum.
+template <typename T>
+double Blas1<T>::finishReduction(cl_kernel partialsKernel, cl_uint partialsArg, size_t n)
+{
+	cl_int status = clSetKernelArg(partialsKernel, partialsArg, sizeof(cl_mem), &partials.get());
+	status |= clSetKernelArg(partialsKernel, partialsArg+1, local * accSize, nullptr);
+	checkStatus("clSetKernelArg-partials", status, true);
+	size_t nGroups = groups(n);
+	lastMilliseconds = 0.0;
+	launch(partialsKernel, nGroups * local, local, "partials");
+
+	cl_kernel k = kernel("reducePartials");
+	int count = nGroups;
+	status = clSetKernelArg(k, 0, sizeof(cl_mem), &partials.get());
+	status |= clSetKernelArg(k, 1, sizeof(int), &count);
+	status |= clSetKernelArg(k, 2, sizeof(cl_mem), &result.get());
+	status |= clSetKernelArg(k, 3, local * accSize, nullptr);
+	checkStatus("clSetKernelArg-reducePartials", status, true);
+	launch(k, local, local, "reducePartials");
+
+	if (floatFloat)
+	{
+		float sum[2];
+		status = clEnqueueReadBuffer(cmdQueue, result, CL_TRUE, 0, sizeof(sum), sum, 0, nullptr, nullptr);
+		checkStatus("clEnqueueReadBuffer-result", status, true);
+		return static_cast<double>(sum[0]) + sum[1];
+	}
+	if (accSize == sizeof(double))
+	{
+		double sum;
+		status = clEnqueueReadBuffer(cmdQueue, result, CL_TRUE, 0, sizeof(sum), &sum, 0, nullptr, nullptr);
+		checkStatus("clEnqueueReadBuffer-result", status, true);
+		return sum;
+	}
+	float sum;
+	status = clEnqueueReadBuffer(cmdQueue, result, CL_TRUE, 0, sizeof(sum), &sum, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer-result", status, true);
+	return sum;
+}
+
+template <typename T>
+double Blas1<T>::dot(cl_mem X, cl_mem Y, size_t n)
+{
+	cl_kernel k = kernel("dotPartials");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 1, sizeof(cl_mem), &Y);
+	status |= clSetKernelArg(k, 2, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-dotPartials", status, true);
+	return finishReduction(k, 3, n);
+}
+
+template <typename T>
+double Blas1<T>::nrm2(cl_mem X, size_t n)
+{
+	cl_kernel k = kernel("nrm2Partials");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 1, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-nrm2Partials", status, true);
+	return sqrt(finishReduction(k, 2, n));
+}
+
+template <typename T>
+double Blas1<T>::axpbyDot(T a, cl_mem X, T b, cl_mem Y, cl_mem Z, size_t n)
+{
+	cl_kernel k = kernel("axpbyDotPartials");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(T), &a);
+	status |= clSetKernelArg(k, 1, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 2, sizeof(T), &b);
+	status |= clSetKernelArg(k, 3, sizeof(cl_mem), &Y);
+	status |= clSetKernelArg(k, 4, sizeof(cl_mem), &Z);
+	status |= clSetKernelArg(k, 5, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-axpbyDotPartials", status, true);
+	return finishReduction(k, 6, n);
+}
+
+// The existing one-element-per-work-item kernel (saxpy.cl or daxpy.cl):
+// Z = a*X + Y. Returns its device time in milliseconds.
+template <typename T>
+double scalarAxpy(OpenCLRuntime& rt, cl_command_queue cmdQueue, T a, cl_mem X, cl_mem Y, size_t n, cl_mem Z)
+{
+	cl_kernel k = (sizeof(T) == sizeof(double)) ? rt.kernel("daxpy.cl", "daxpy") : rt.kernel("saxpy.cl", "saxpy");
+	int iN = n;
+	cl_int status = clSetKernelArg(k, 0, sizeof(T), &a);
+	status |= clSetKernelArg(k, 1, sizeof(cl_mem), &X);
+	status |= clSetKernelArg(k, 2, sizeof(cl_mem), &Y);
+	status |= clSetKernelArg(k, 3, sizeof(int), &iN);
+	status |= clSetKernelArg(k, 4, sizeof(cl_mem), &Z);
+	checkStatus("clSetKernelArg-scalarAxpy", status, true);
+	size_t globalWorkSize[] = { n };
+	cl_event ev;
+	status = clEnqueueNDRangeKernel(cmdQueue, k, 1, nullptr, globalWorkSize, nullptr, 0, nullptr, &ev);
+	checkStatus("clEnqueueNDRangeKernel-scalarAxpy", status, true);
+	EventHandle done(ev);
+	clWaitForEvents(1, &ev);
+	return profiledMilliseconds(ev);
+}
+
+// ---------------------------------------------------------------------
+// Accuracy: elementwise results must be within a couple of roundings of
+// the exact result (the device may or may not fuse a*x + y into an fma);
+// sums must be within the usual error bound for the order the kernels
+// add in: one rounding per product, plus, per addition along the longest
+// chain (a work-item's grid-stride loop, then two tree reductions), one
+// rounding of the accumulator, relative to the sum of the magnitudes.
+// ---------------------------------------------------------------------
+
+// Reports the check and returns whether it passed
+bool report(const char* what, size_t n, double error, double tolerance)
+{
+	bool ok = (error <= tolerance); // false for NaN
+	std::cout << "  " << std::left << std::setw(9) << what << std::right << " n = " << std::setw(9) << n
+	          << ": relative error " << std::setw(12) << error << " (tolerance " << tolerance << ")"
+	          << (ok ? "" : "  WRONG") << '\n';
+	return ok;
+}
+
+// The largest error of "got" relative to the exact a*x + b*y (relative to
+// |a*x| + |b*y|, that is, which is what the roundings are proportional to)
+template <typename T>
+double elementwiseError(const std::vector<T>& got, T a, const std::vector<T>& X, T b, const std::vector<T>& Y)
+{
+	double worst = 0.0;
+	for (size_t i=0 ; i<got.size() ; i++)
+	{
+		long double exact = static_cast<long double>(a) * X[i] + static_cast<long double>(b) * Y[i];
+		long double scale = fabsl(static_cast<long double>(a) * X[i]) + fabsl(static_cast<long double>(b) * Y[i]);
+		double err = static_cast<double>(fabsl(got[i] - exact) / (scale + DBL_MIN));
+		if (!(err <= worst)) // keeps NaN
+			worst = err;
+	}
+	return worst;
+}
+
+// Returns false if anything is out of tolerance
+template <typename T>
+bool checkAccuracy(OpenCLRuntime& rt, Blas1<T>& blas, size_t n)
+{
+	double eps = (sizeof(T) == sizeof(double)) ? DBL_EPSILON : FLT_EPSILON;
+	size_t bytes = std::max<size_t>(n, 1) * sizeof(T);
+	std::vector<T> X(n), Y(n), Z(n), got(n);
+	// Values in [0.5, 1.5) with no simple structure: large enough sums to
+	// show the accumulator's rounding, and every element matters
+	for (size_t i=0 ; i<n ; i++)
+	{
+		X[i] = 0.5 + ((i * 7919) % 10007) / 10007.0;
+		Y[i] = 0.5 + ((i * 104729 + 13) % 9973) / 9973.0;
+		Z[i] = 1.5 - ((i * 3571) % 1009) / 1009.0;
+	}
+	PooledBuffer d_X = rt.acquireBuffer(bytes);
+	PooledBuffer d_Y = rt.acquireBuffer(bytes);
+	PooledBuffer d_Z = rt.acquireBuffer(bytes);
+	cl_command_queue cmdQueue = blas.queue();
+	auto upload = [&](cl_mem buf, const std::vector<T>& v)
+	{
+		cl_int status = clEnqueueWriteBuffer(cmdQueue, buf, CL_TRUE, 0, n * sizeof(T), v.data(), 0, nullptr, nullptr);
+		checkStatus("clEnqueueWriteBuffer", status, true);
+	};
+	auto download = [&](cl_mem buf, std::vector<T>& v)
+	{
+		cl_int status = clEnqueueReadBuffer(cmdQueue, buf, CL_TRUE, 0, n * sizeof(T), v.data(), 0, nullptr, nullptr);
+		checkStatus("clEnqueueReadBuffer", status, true);
+	};
+	if (n > 0)
+	{
+		upload(d_X, X);
+		upload(d_Y, Y);
+		upload(d_Z, Z);
+	}
+
+	// The longest chain of additions into one sum: a work-item's vectors
+	// (VW lanes each) and tail element, its work-group's tree, the final
+	// pass's share of the partial sums, and its tree. (Doubled, since
+	// float-float sums take two additions per partial sum.)
+	size_t vectorWidth = 16 / sizeof(T);
+	size_t nGroups = blas.groups(n);
+	size_t global = nGroups * blas.localSize();
+	double treeDepth = log2(static_cast<double>(blas.localSize()));
+	double chain = ((n / vectorWidth + global - 1) / global) * vectorWidth + 1 + treeDepth +
+		(nGroups + blas.localSize() - 1) / blas.localSize() + treeDepth;
+	double sumTolerance = eps + 2.0 * chain * blas.accumulatorEpsilon();
+	bool ok = true;
+
+	T a = 2.5, b = -0.75;
+	if (n > 0)
+	{
+		blas.axpy(a, d_X, d_Y, n);
+		download(d_Y, got);
+		ok &= report("axpy", n, elementwiseError(got, a, X, T(1), Y), 2.0 * eps);
+		upload(d_Y, Y);
+
+		blas.scal(a, d_Z, n);
+		download(d_Z, got);
+		ok &= report("scal", n, elementwiseError(got, a, Z, T(0), Z), 2.0 * eps);
+		upload(d_Z, Z);
+	}
+
+	long double exact = 0.0, magnitude = 0.0;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		exact += static_cast<long double>(X[i]) * Y[i];
+		magnitude += fabsl(static_cast<long double>(X[i]) * Y[i]);
+	}
+	double d = blas.dot(d_X, d_Y, n);
+	ok &= report("dot", n, static_cast<double>(fabsl(d - exact) / (magnitude + DBL_MIN)), sumTolerance);
+
+	exact = 0.0;
+	for (size_t i=0 ; i<n ; i++)
+		exact += static_cast<long double>(X[i]) * X[i];
+	double norm = blas.nrm2(d_X, n);
+	// sqrt halves the relative error of the sum of squares
+	ok &= report("nrm2", n, static_cast<double>(fabsl(norm - sqrtl(exact)) / (sqrtl(exact) + DBL_MIN)),
+		0.5 * sumTolerance);
+
+	// The dot product is checked against the new Y the device computed, so
+	// this checks the reduction and the update separately
+	d = blas.axpbyDot(a, d_X, b, d_Y, d_Z, n);
+	if (n > 0)
+		download(d_Y, got);
+	double updateError = elementwiseError(got, a, X, b, Y);
+	exact = magnitude = 0.0;
+	for (size_t i=0 ; i<n ; i++)
+	{
+		exact += static_cast<long double>(got[i]) * Z[i];
+		magnitude += fabsl(static_cast<long double>(got[i]) * Z[i]);
+	}
+	ok &= report("axpby", n, updateError, 2.0 * eps);
+	ok &= report("+dot", n, static_cast<double>(fabsl(d - exact) / (magnitude + DBL_MIN)), sumTolerance);
+	return ok;
+}
+
+// ---------------------------------------------------------------------
+// Throughput: the median device time of "reps" runs of each kernel (after
+// one untimed run), and the bandwidth that implies for the data each must
+// read and write once.
+// ---------------------------------------------------------------------
+
+void reportThroughput(const char* what, double bytes, std::vector<double>& ms)
+{
+	TimingSummary t = summarize(ms);
+	std::cout << "  " << std::left << std::setw(14) << what << std::right << std::setw(10) << t.median << " ms "
+	          << std::setw(9) << (bytes / (t.median * 1.0e-3) * 1.0e-9) << " GB/s\n";
+}
+
+template <typename T>
+void measureThroughput(OpenCLRuntime& rt, Blas1<T>& blas, cl_command_queue cmdQueue, size_t n, int reps,
+	bool compareScalar)
+{
+	size_t bytes = n * sizeof(T);
+	std::vector<T> ones(n, T(1));
+	PooledBuffer d_X = rt.acquireBuffer(bytes);
+	PooledBuffer d_Y = rt.acquireBuffer(bytes);
+	PooledBuffer d_Z = rt.acquireBuffer(bytes);
+	cl_int status = clEnqueueWriteBuffer(cmdQueue, d_X, CL_FALSE, 0, bytes, ones.data(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+	status = clEnqueueWriteBuffer(cmdQueue, d_Y, CL_FALSE, 0, bytes, ones.data(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+	status = clEnqueueWriteBuffer(cmdQueue, d_Z, CL_TRUE, 0, bytes, ones.data(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Z", status, true);
+
+	std::cout << "  n = " << n << ", " << blas.groups(n) << " work-groups of " << blas.localSize() << ":\n";
+	// Values stay put: a = 0 and b = 1 leave Y alone, and scal by 1 leaves X
+	std::vector<double> axpyMs, scalarMs, scalMs, dotMs, nrm2Ms, fusedMs;
+	for (int rep=0 ; rep<=reps ; rep++)
+	{
+		blas.axpy(T(0), d_X, d_Y, n);
+		axpyMs.push_back(blas.lastMilliseconds);
+		if (compareScalar)
+			scalarMs.push_back(scalarAxpy(rt, cmdQueue, T(0), d_X, d_Y, n, d_Z));
+		blas.scal(T(1), d_X, n);
+		scalMs.push_back(blas.lastMilliseconds);
+		blas.dot(d_X, d_Y, n);
+		dotMs.push_back(blas.lastMilliseconds);
+		blas.nrm2(d_X, n);
+		nrm2Ms.push_back(blas.lastMilliseconds);
+		blas.axpbyDot(T(0), d_X, T(1), d_Y, d_Z, n);
+		fusedMs.push_back(blas.lastMilliseconds);
+		if (rep == 0)
+			for (std::vector<double>* v : { &axpyMs, &scalarMs, &scalMs, &dotMs, &nrm2Ms, &fusedMs })
+				v->clear();
+	}
+	reportThroughput("axpy", 3.0 * bytes, axpyMs);
+	if (compareScalar)
+		reportThroughput((sizeof(T) == sizeof(double)) ? "daxpy.cl" : "saxpy.cl", 3.0 * bytes, scalarMs);
+	reportThroughput("scal", 2.0 * bytes, scalMs);
+	reportThroughput("dot", 2.0 * bytes, dotMs);
+	reportThroughput("nrm2", 1.0 * bytes, nrm2Ms);
+	// Versus axpby then dot as two passes: 3 + 2 vectors' worth of traffic
+	reportThroughput("axpby+dot", 4.0 * bytes, fusedMs);
+}
+
+template <typename T>
+bool runSuite(OpenCLRuntime& rt, Precision precision, bool floatFloat, const std::vector<size_t>& sizes,
+	size_t localSize, size_t maxGroups, int reps)
+{
+	QueueHandle profilingQueue = rt.createQueue(CL_QUEUE_PROFILING_ENABLE);
+	Blas1<T> blas(rt, profilingQueue, precision, floatFloat, localSize, maxGroups);
+	const char* data = (sizeof(T) == sizeof(double)) ? "double" : "float";
+	std::cout << '\n' << data << " data, " << blas.accumulator() << " sums:\n";
+	bool ok = true;
+	for (size_t i=0 ; i<sizes.size() ; i++)
+		ok &= checkAccuracy(rt, blas, sizes[i]);
+	size_t largest = *std::max_element(sizes.begin(), sizes.end());
+	if (largest > 0)
+		measureThroughput(rt, blas, profilingQueue, largest, reps, precision != MIXED);
+	return ok;
+}
+
+std::vector<size_t> parseList(const char* s)
+{
+	std::vector<size_t> values;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, ','))
+		if (!item.empty())
+			values.push_back(atol(item.c_str()));
+	return values;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	bool single = false, dbl = false, mixed = false, floatFloat = false;
+	// Empty, tiny, every tail length, and large enough to time
+	std::vector<size_t> sizes = { 0, 1, 2, 3, 5, 6, 7, 1000, 1000003, 16777219 };
+	size_t localSize = 256;
+	size_t maxGroups = 0; // 0: 16 per compute unit
+	int reps = 10;
+	if (argc > 1)
+	{
+		for (int i=1 ; i<argc ; i++)
+		{
+			if (strcmp("-debug", argv[i]) == 0)
+				debug = true;
+			else if (strcmp("-single", argv[i]) == 0)
+				single = true;
+			else if (strcmp("-double", argv[i]) == 0)
+				dbl = true;
+			else if (strcmp("-mixed", argv[i]) == 0)
+				mixed = true;
+			else if (strcmp("-floatfloat", argv[i]) == 0)
+				floatFloat = mixed = true;
+			else if (strncmp("-sizes=", argv[i], 7) == 0)
+				sizes = parseList(argv[i]+7);
+			else if (strncmp("-local=", argv[i], 7) == 0)
+				localSize = std::max(1, atoi(argv[i]+7));
+			else if (strncmp("-groups=", argv[i], 8) == 0)
+				maxGroups = std::max(1, atoi(argv[i]+8));
+			else if (strncmp("-reps=", argv[i], 6) == 0)
+				reps = std::max(1, atoi(argv[i]+6));
+			else if (argv[i][0] == '-')
+			{
+				switch (argv[i][1])
+				{
+					case 'a':
+						devType = CL_DEVICE_TYPE_ALL;
+						break;
+					case 'c':
+						devType = CL_DEVICE_TYPE_CPU;
+						break;
+					case 'g':
+						devType = CL_DEVICE_TYPE_GPU;
+						break;
+				}
+			}
+		}
+	}
+	if (!single && !dbl && !mixed)
+		single = dbl = mixed = true;
+	// The kernels' "n" is an int
+	sizes.erase(std::remove_if(sizes.begin(), sizes.end(), [](size_t n) { return n > INT_MAX; }), sizes.end());
+	if (sizes.empty())
+		sizes.push_back(1000003);
+
+	OpenCLRuntime* rt = OpenCLRuntime::get(devType);
+	if (rt == nullptr)
+	{
+		std::cerr << "No OpenCL device to run the kernels on; nothing was checked\n";
+		return 1;
+	}
+	if (maxGroups == 0)
+	{
+		cl_uint computeUnits = 1;
+		clGetDeviceInfo(rt->device(), CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &computeUnits, nullptr);
+		maxGroups = 16 * std::max<cl_uint>(computeUnits, 1);
+	}
+	bool fp64 = deviceSupportsFP64(rt->device());
+
+	bool ok = true;
+	if (single)
+		ok &= runSuite<float>(*rt, SINGLE, false, sizes, localSize, maxGroups, reps);
+	if (dbl)
+	{
+		if (fp64)
+			ok &= runSuite<double>(*rt, DOUBLE, false, sizes, localSize, maxGroups, reps);
+		else
+			std::cout << "\nThe device does not support double precision; skipping double\n";
+	}
+	if (mixed)
+		ok &= runSuite<float>(*rt, MIXED, floatFloat || !fp64, sizes, localSize, maxGroups, reps);
+
+	std::cout << '\n' << (ok ? "All results within tolerance" : "Some results out of tolerance") << '\n';
+	return ok ? 0 : 1;
+}
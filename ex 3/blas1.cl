@@ -0,0 +1,200 @@
+// blas1.cl: BLAS level 1 operations on vectors of any length.
+//
+// Build options choose the precision:
+//   (none)               float data, float accumulation
+//   -DREAL_IS_DOUBLE     double data, double accumulation (needs cl_khr_fp64)
+//   -DACCUM_DOUBLE       float data, double accumulation (needs cl_khr_fp64)
+//   -DACCUM_FLOAT_FLOAT  float data, accumulated as unevaluated sums of two
+//                        floats (hi + lo), for devices without cl_khr_fp64
+//
+// Every kernel walks the vectors with a grid-stride loop over VW-wide
+// vectors (float4 or double2), so it works with any global size, and the
+// n % VW elements after the last full vector are handled by work-item 0
+// (so even a global size of 1 covers them). vloadN and vstoreN only need the alignment of the element
+// type, so the vectors may start anywhere.
+//
+// The reductions (dotPartials, nrm2Partials, axpbyDotPartials) leave one
+// partial sum per work-group in "partials"; reducePartials then adds those
+// up in a single work-group. Both use tree reductions in __local memory, so
+// local sizes must be powers of two.
+
+#if defined(REAL_IS_DOUBLE) || defined(ACCUM_DOUBLE)
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+#endif
+
+#ifdef REAL_IS_DOUBLE
+#define REAL double
+#define REALV double2
+#define VW 2
+#define VLOAD vload2
+#define VSTORE vstore2
+#else
+#define REAL float
+#define REALV float4
+#define VW 4
+#define VLOAD vload4
+#define VSTORE vstore4
+#endif
+
+#if defined(ACCUM_FLOAT_FLOAT)
+
+// hi + lo, with |lo| at most half an ulp of hi
+typedef float2 ACC;
+#define ACC_ZERO ((float2)(0.0f, 0.0f))
+
+ACC accAdd(ACC s, float v)
+{
+	// Knuth's TwoSum: t + e == s.x + v exactly
+	float t = s.x + v;
+	float bv = t - s.x;
+	float e = (s.x - (t - bv)) + (v - bv);
+	e += s.y;
+	// Renormalize
+	float hi = t + e;
+	return (float2)(hi, e - (hi - t));
+}
+
+ACC accCombine(ACC a, ACC b)
+{
+	return accAdd(accAdd(a, b.x), b.y);
+}
+
+#else
+
+#if defined(REAL_IS_DOUBLE) || defined(ACCUM_DOUBLE)
+typedef double ACC;
+#define ACC_ZERO 0.0
+#else
+typedef float ACC;
+#define ACC_ZERO 0.0f
+#endif
+
+#define accAdd(s, v) ((s) + (ACC)(v))
+#define accCombine(a, b) ((a) + (b))
+
+#endif
+
+// Add the VW lanes of "v" to "s"
+ACC accAddV(ACC s, REALV v)
+{
+#if VW == 4
+	return accAdd(accAdd(accAdd(accAdd(s, v.s0), v.s1), v.s2), v.s3);
+#else
+	return accAdd(accAdd(s, v.s0), v.s1);
+#endif
+}
+
+// The sum of every work-item's "mine" in the work-group
+ACC groupSum(ACC mine, __local ACC* scratch)
+{
+	int lid = get_local_id(0);
+	scratch[lid] = mine;
+	barrier(CLK_LOCAL_MEM_FENCE);
+	for (int s=get_local_size(0)/2 ; s>0 ; s>>=1)
+	{
+		if (lid < s)
+			scratch[lid] = accCombine(scratch[lid], scratch[lid+s]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	return scratch[0];
+}
+
+// Y = a*X + Y
+__kernel
+void axpy(REAL a, __global const REAL* X, __global REAL* Y, int n)
+{
+	int nv = n / VW;
+	for (int i=get_global_id(0) ; i<nv ; i+=get_global_size(0))
+		VSTORE(a * VLOAD(i, X) + VLOAD(i, Y), i, Y);
+	if (get_global_id(0) == 0)
+		for (int t=nv*VW ; t<n ; t++)
+			Y[t] = a * X[t] + Y[t];
+}
+
+// X = a*X
+__kernel
+void scal(REAL a, __global REAL* X, int n)
+{
+	int nv = n / VW;
+	for (int i=get_global_id(0) ; i<nv ; i+=get_global_size(0))
+		VSTORE(a * VLOAD(i, X), i, X);
+	if (get_global_id(0) == 0)
+		for (int t=nv*VW ; t<n ; t++)
+			X[t] *= a;
+}
+
+// Partial sums of X . Y
+__kernel
+void dotPartials(__global const REAL* X, __global const REAL* Y, int n,
+	__global ACC* partials, __local ACC* scratch)
+{
+	ACC sum = ACC_ZERO;
+	int nv = n / VW;
+	for (int i=get_global_id(0) ; i<nv ; i+=get_global_size(0))
+		sum = accAddV(sum, VLOAD(i, X) * VLOAD(i, Y));
+	if (get_global_id(0) == 0)
+		for (int t=nv*VW ; t<n ; t++)
+			sum = accAdd(sum, X[t] * Y[t]);
+	ACC total = groupSum(sum, scratch);
+	if (get_local_id(0) == 0)
+		partials[get_group_id(0)] = total;
+}
+
+// Partial sums of X . X (the host takes the square root). Nothing is
+// rescaled, so elements whose squares overflow REAL overflow here too.
+__kernel
+void nrm2Partials(__global const REAL* X, int n, __global ACC* partials, __local ACC* scratch)
+{
+	ACC sum = ACC_ZERO;
+	int nv = n / VW;
+	for (int i=get_global_id(0) ; i<nv ; i+=get_global_size(0))
+	{
+		REALV x = VLOAD(i, X);
+		sum = accAddV(sum, x * x);
+	}
+	if (get_global_id(0) == 0)
+		for (int t=nv*VW ; t<n ; t++)
+			sum = accAdd(sum, X[t] * X[t]);
+	ACC total = groupSum(sum, scratch);
+	if (get_local_id(0) == 0)
+		partials[get_group_id(0)] = total;
+}
+
+// Y = a*X + b*Y, and partial sums of (the new) Y . Z, in one pass over the
+// vectors. Z may be X, but not Y.
+__kernel
+void axpbyDotPartials(REAL a, __global const REAL* X, REAL b, __global REAL* Y, __global const REAL* Z, int n,
+	__global ACC* partials, __local ACC* scratch)
+{
+	ACC sum = ACC_ZERO;
+	int nv = n / VW;
+	for (int i=get_global_id(0) ; i<nv ; i+=get_global_size(0))
+	{
+		REALV y = a * VLOAD(i, X) + b * VLOAD(i, Y);
+		VSTORE(y, i, Y);
+		sum = accAddV(sum, y * VLOAD(i, Z));
+	}
+	if (get_global_id(0) == 0)
+		for (int t=nv*VW ; t<n ; t++)
+		{
+			REAL y = a * X[t] + b * Y[t];
+			Y[t] = y;
+			sum = accAdd(sum, y * Z[t]);
+		}
+	ACC total = groupSum(sum, scratch);
+	if (get_local_id(0) == 0)
+		partials[get_group_id(0)] = total;
+}
+
+// The final pass: result[0] = the sum of the "count" partial sums. Launch
+// a single work-group.
+__kernel
+void reducePartials(__global const ACC* partials, int count, __global ACC* result, __local ACC* scratch)
+{
+	ACC sum = ACC_ZERO;
+	for (int i=get_local_id(0) ; i<count ; i+=get_local_size(0))
+		sum = accCombine(sum, partials[i]);
+	ACC total = groupSum(sum, scratch);
+	if (get_local_id(0) == 0)
+		result[0] = total;
+}
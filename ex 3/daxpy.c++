@@ -1,358 +1,667 @@
-// This program implements daxpy using OpenCL
-
-// System includes
-#include <iostream>
-#include <string>
-#include <string.h>
-#include <math.h>
-
-// OpenCL includes
-#ifdef __APPLE__
-#include <OpenCL/opencl.h>
-#else
-#include <CL/opencl.h>
-#endif
-
-const char* readSource(const char* fileName);
-
-// A couple simple utility functions:
-bool debug = false;
-void checkStatus(std::string where, cl_int status, bool abortOnError)
-{
-	if (debug || (status != 0))
-		std::cout << "Step " << where << ", status = " << status << '\n';
-	if ((status != 0) && abortOnError)
-		exit(1);
-}
-
-void lookAtDeviceLimits(cl_device_id dev)
-{
-	cl_ulong gms;
-	clGetDeviceInfo(dev, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &gms, nullptr);
-	cl_ulong lms;
-	clGetDeviceInfo(dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &lms, nullptr);
-	size_t mwgs;
-	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &mwgs, nullptr);
-	cl_uint maxCUs;
-	clGetDeviceInfo(dev, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &maxCUs, nullptr);
-
-	std::cout << "Device global mem size:     " << gms << '\n';
-	std::cout << "Device local mem size:      " << lms << '\n';
-	std::cout << "Device max work group size: " << mwgs << '\n';
-	std::cout << "Device max compute units:   " << maxCUs << '\n';
-	std::cout << '\n';
-}
-
-void lookAtKernelLimits(cl_kernel kernel, cl_device_id dev)
-{
-	cl_ulong lms = -1;
-	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_LOCAL_MEM_SIZE, sizeof(cl_ulong), &lms, nullptr);
-	cl_ulong pms = -1;
-	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_PRIVATE_MEM_SIZE, sizeof(cl_ulong), &pms, nullptr);
-	size_t warpSize = -1;
-	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &warpSize, nullptr);
-	size_t maxWorkGroupSize = -1;
-	clGetKernelWorkGroupInfo(kernel, dev, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &maxWorkGroupSize, nullptr);
-
-	std::cout << "Kernel local memory size:   " << lms << '\n';
-	std::cout << "Kernel private memory size: " << pms << '\n';
-	std::cout << "Kernel warpSize:            " << warpSize << '\n';
-	std::cout << "Kernel max work group size: " << maxWorkGroupSize << '\n';
-	std::cout << '\n';
-}
-
-void reportVersion(cl_platform_id platform)
-{
-	// Get the version of OpenCL supported on this platform
-	size_t strLength;
-	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, 0, nullptr, &strLength);
-	char* version = new char[strLength+1];
-	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, strLength+1, version, &strLength);
-	std::cout << version << '\n';
-	delete [] version;
-}
-
-void showProgramBuildLog(cl_program pgm, cl_device_id dev)
-{
-	size_t size;
-	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, 0, nullptr, &size);
-	char* log = new char[size+1];
-	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, size+1, log, nullptr);
-	std::cout << "LOG:\n" << log << "\n\n";
-	delete [] log;
-}
-
-// Typical OpenCL startup
-
-// Some global state variables (These would be better packaged as
-// instance variables of some class.)
-// 1) Platforms
-cl_uint numPlatforms = 0;
-cl_platform_id* platforms = nullptr;
-cl_platform_id curPlatform;
-// 2) Devices
-cl_uint numDevices = 0;
-cl_device_id* devices = nullptr;
-
-// Return value is device index to use; -1 ==> no available devices
-int typicalOpenCLProlog(cl_device_type desiredDeviceType)
-{
-	// ----------------------------------------------------
-	// Discover and initialize the platforms
-	// ----------------------------------------------------
-
-	cl_int status = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	checkStatus("clGetPlatformIDs-0", status, true);
-	if (numPlatforms <= 0)
-	{
-		std::cout << "No platforms!\n";
-		return -1;
-	}
-
-	platforms = new cl_platform_id[numPlatforms];
- 
-	status = clGetPlatformIDs(numPlatforms, platforms, nullptr);
-	checkStatus("clGetPlatformIDs-1", status, true);
-	curPlatform = platforms[0];
-	if (numPlatforms > 1)
-	{
-		size_t platformNameSize = 0;
-		clGetPlatformInfo(curPlatform, CL_PLATFORM_NAME, 0, nullptr, &platformNameSize);
-		char* name = new char[platformNameSize+1];
-		clGetPlatformInfo(curPlatform, CL_PLATFORM_NAME, platformNameSize+1, name, nullptr);
-		std::cout << "Found " << numPlatforms << " platforms. Arbitrarily using: " << name << '\n';
-		delete [] name;
-	}
-
-	reportVersion(curPlatform);
-
-	// ------------------------------------------------------------------
-	// Discover and initialize the devices on a specific platform
-	// ------------------------------------------------------------------
-
-	status = clGetDeviceIDs(curPlatform, desiredDeviceType, 0, nullptr, &numDevices);
-	checkStatus("clGetDeviceIDs-0", status, true);
-	if (numDevices <= 0)
-	{
-		std::cout << "No devices on platform!\n";
-		return -1;
-	}
-
-	devices = new cl_device_id[numDevices];
-
-	status = clGetDeviceIDs(curPlatform, desiredDeviceType, numDevices, devices, nullptr);
-	checkStatus("clGetDeviceIDs-1", status, true);
-	int devIndex = 0;
-	if (numDevices > 1)
-	{
-		size_t nameLength;
-		for (int idx=0 ; idx<numDevices ; idx++)
-		{
-			clGetDeviceInfo(devices[idx], CL_DEVICE_NAME, 0, nullptr, &nameLength);
-			char* name = new char[nameLength+1];
-			clGetDeviceInfo(devices[idx], CL_DEVICE_NAME, nameLength+1, name, nullptr);
-			// You can also query lots of other things about the device capability,
-			// for example, CL_DEVICE_EXTENSIONS to see if "cl_khr_fp64". (See also
-			// the first line of daxpy.cl.)
-			std::cout << "Device " << idx << ": " << name << '\n';
-		}
-		devIndex = -1;
-		while ((devIndex < 0) || (devIndex >= numDevices))
-		{
-			std::cout << "Which device do you want to use? ";
-			std::cin >> devIndex;
-		}
-	}
-	else if (numDevices <= 0)
-		std::cout << "No devices found\n";
-	else
-		std::cout << "Only one device detected\n";
-	return devIndex;
-}
-
-void doTheKernelLaunch(cl_device_id dev, double a, double* h_X, double* h_Y, size_t n, double* h_Z)
-{
-	// --------------------------------------------------
-	// Create a context for the one chosen device
-	// --------------------------------------------------
-	
-	cl_int status;
-	cl_context context = clCreateContext(nullptr, 1, &dev, nullptr, nullptr, &status);
-	checkStatus("clCreateContext", status, true);
-
-	// ------------------------------------------------------------
-	// Create a command queue for one device in the context
-	// (There is one queue per device per context.)
-	// ------------------------------------------------------------
-
-	cl_command_queue cmdQueue = clCreateCommandQueue(context, dev, 0, &status);
-	checkStatus("clCreateCommandQueue", status, true);
-
-	// ---------------------------------------------------------
-	// Create device buffers associated with the context
-	// ---------------------------------------------------------
-
-	size_t datasize = n * sizeof(double);
-
-	cl_mem bufferX = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-X", status, true);
-
-	cl_mem bufferY = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-Y", status, true);
-
-	cl_mem bufferZ = clCreateBuffer( // Output array on the device
-		context, CL_MEM_WRITE_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-Z", status, true);
-
-	// ------------------------------------------------------
-	// Use the command queue to encode requests to write host
-	// data to the device buffers
-	// ------------------------------------------------------
-
-	status = clEnqueueWriteBuffer(cmdQueue, 
-		bufferX, CL_FALSE, 0, datasize,                         
-		h_X, 0, nullptr, nullptr);
-	checkStatus("clEnqueueWriteBuffer-X", status, true);
-
-	status = clEnqueueWriteBuffer(cmdQueue, 
-		bufferY, CL_FALSE, 0, datasize,                                  
-		h_Y, 0, nullptr, nullptr);
-	checkStatus("clEnqueueWriteBuffer-Y", status, true);
-
-	// ----------------------------------------------------
-	// Create, compile, and link the program
-	// ----------------------------------------------------
-
-	const char* programSource[] = { readSource("daxpy.cl") };
-	cl_program program = clCreateProgramWithSource(context, 
-		1, programSource, nullptr, &status);
-	checkStatus("clCreateProgramWithSource", status, true);
-
-	status = clBuildProgram(program, 1, &dev, nullptr, nullptr, nullptr);
-	checkStatus("clBuildProgram", status, false);
-	if (status != 0)
-		showProgramBuildLog(program, dev);
-
-	// ---------------------------------------------------------------------
-	// Create a kernel using a "__kernel" function in the ".cl" file
-	// ---------------------------------------------------------------------
-
-	cl_kernel kernel = clCreateKernel(program, "daxpy", &status);
-
-	lookAtDeviceLimits(dev);
-	lookAtKernelLimits(kernel, dev);
-
-	// ----------------------------------------------------
-	// Set the kernel arguments
-	// ----------------------------------------------------
-
-	status = clSetKernelArg(kernel, 0, sizeof(double), &a);
-	checkStatus("clSetKernelArg-0", status, true);
-	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &bufferX);
-	checkStatus("clSetKernelArg-1", status, true);
-	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &bufferY);
-	checkStatus("clSetKernelArg-2", status, true);
-	status = clSetKernelArg(kernel, 3, sizeof(int), &n);
-	checkStatus("clSetKernelArg-3", status, true);
-	status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &bufferZ);
-	checkStatus("clSetKernelArg-4", status, true);
-
-	// ----------------------------------------------------
-	// Configure the work-item structure
-	// ----------------------------------------------------
-
-	size_t globalWorkSize[] = { n };    
-
-	// ---------------------------------------------------
-	// Enqueue the kernel for execution
-	// ----------------------------------------------------
-
-	status = clEnqueueNDRangeKernel(cmdQueue, 
-		kernel, 1, nullptr, globalWorkSize, 
-		nullptr, 0, nullptr, nullptr);
-	checkStatus("clEnqueueNDRangeKernel", status, true);
-
-	// ----------------------------------------------------
-	// Read the output buffer back to the host
-	// ----------------------------------------------------
-
-	clEnqueueReadBuffer(cmdQueue, 
-		bufferZ, CL_TRUE, 0, datasize, 
-		h_Z, 0, nullptr, nullptr);
-
-	// ----------------------------------------------------
-	// Release OpenCL resources
-	// ----------------------------------------------------
-
-	// Free OpenCL resources
-	clReleaseKernel(kernel);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(cmdQueue);
-	clReleaseMemObject(bufferX);
-	clReleaseMemObject(bufferY);
-	clReleaseMemObject(bufferZ);
-	clReleaseContext(context);
-
-	// Free host resources
-	delete [] platforms;
-	delete [] devices;
-}
-
-double* do_daxpy(cl_device_id curDevice, size_t n)
-{
-	double a = 2.0;
-	double* X = new double[n];
-	double* Y = new double[n];
-	double* Z = new double[n];
-	for (int i=0 ; i<n ; i++)
-	{
-		X[i] = 1000.0;
-		Y[i] =   10.0;
-		Z[i] = -999.99;
-	}
-	doTheKernelLaunch(curDevice, a, X, Y, n, Z);
-	for (int i=0 ; i<n ; i++)
-		std::cout << Z[i] << " = " << a << " * " << X[i] << "  +  " << Y[i] << '\n';
-	delete [] X;
-	delete [] Y;
-	return Z;
-}
-
-int main(int argc, char* argv[])
-{
-	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
-	if (argc > 1)
-	{
-		for (int i=1 ; i<argc ; i++)
-		{
-			if (strcmp("-debug", argv[i]) == 0)
-				debug = true;
-			else if (argv[i][0] == '-')
-			{
-				switch (argv[i][1])
-				{
-					case 'a':
-						devType = CL_DEVICE_TYPE_ALL;
-						break;
-					case 'c':
-						devType = CL_DEVICE_TYPE_CPU;
-						break;
-					case 'g':
-						devType = CL_DEVICE_TYPE_GPU;
-						break;
-				}
-			}
-		}
-	}
-	int deviceIndex = typicalOpenCLProlog(devType);
-	if (deviceIndex < 0)
-		return 0;
-
-	double* Z = do_daxpy(devices[deviceIndex], 20);
-	// ...
-	delete [] Z;
-
-	return 0;
-}
+// This program implements daxpy using OpenCL
+
+// System includes
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+// OpenCL includes
+#include "OpenCLRuntime.h"
+#include "HostArray.h"
+#include "MappedFile.h"
+#include "Autotuner.h"
+#include "Profiling.h"
+#include "MultiDevice.h"
+#include "HostCompute.h"
+
+// How doTheKernelLaunch gets data to and from the device
+enum TransferMode
+{
+	COPY,     // new buffers on every call; clEnqueueWriteBuffer/clEnqueueReadBuffer
+	POOLED,   // buffers reused from the runtime's pool; same copies as COPY
+	ZERO_COPY // the host arrays are HostArrays; map/unmap instead of copies
+};
+
+// The work-group size saved by "-tune" for n elements, or 0 (let the
+// implementation choose) if daxpy has not been tuned for this device and size
+size_t daxpyLocalSize(OpenCLRuntime& rt, size_t n)
+{
+	LaunchConfig config;
+	if (findTunedConfig(rt.device(), "daxpy.cl:daxpy", n, config))
+		return config.local[0];
+	return 0;
+}
+
+// Enqueues "kernel" (daxpy.cl's daxpy, from any context) on "cmdQueue" with
+// work-groups of "localSize" (0: the implementation's choice) once the
+// "nWait" events in "waitList" are complete. If "done" is given, it receives
+// an event for the kernel.
+void enqueueDaxpy(cl_kernel kernel, cl_command_queue cmdQueue, size_t localSize, double a, cl_mem d_X, cl_mem d_Y,
+	size_t n, cl_mem d_Z, cl_uint nWait = 0, const cl_event* waitList = nullptr, cl_event* done = nullptr)
+{
+	// ----------------------------------------------------
+	// Set the kernel arguments
+	// ----------------------------------------------------
+
+	int iN = n;
+	cl_int status = clSetKernelArg(kernel, 0, sizeof(double), &a);
+	checkStatus("clSetKernelArg-0", status, true);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_X);
+	checkStatus("clSetKernelArg-1", status, true);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_Y);
+	checkStatus("clSetKernelArg-2", status, true);
+	status = clSetKernelArg(kernel, 3, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-3", status, true);
+	status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &d_Z);
+	checkStatus("clSetKernelArg-4", status, true);
+
+	// ----------------------------------------------------
+	// Configure the work-item structure. With a fixed
+	// work-group size, the global size is rounded up to a
+	// multiple of it; the kernel skips the extra work-items.
+	// ----------------------------------------------------
+
+	size_t globalWorkSize[] = { roundUpGlobal(n, localSize) };
+	size_t localWorkSize[] = { localSize };
+
+	// ---------------------------------------------------
+	// Enqueue the kernel for execution
+	// ----------------------------------------------------
+
+	status = clEnqueueNDRangeKernel(cmdQueue, 
+		kernel, 1, nullptr, globalWorkSize, 
+		(localSize == 0) ? nullptr : localWorkSize, nWait, waitList, done);
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+}
+
+// As above, with the runtime's kernel
+void enqueueDaxpy(OpenCLRuntime& rt, cl_command_queue cmdQueue, size_t localSize, double a, cl_mem d_X, cl_mem d_Y,
+	size_t n, cl_mem d_Z, cl_uint nWait = 0, const cl_event* waitList = nullptr, cl_event* done = nullptr)
+{
+	// ---------------------------------------------------------------------
+	// Get the kernel for the "__kernel" function in the ".cl" file (the
+	// program is compiled the first time it is requested)
+	// ---------------------------------------------------------------------
+
+	enqueueDaxpy(rt.kernel("daxpy.cl", "daxpy"), cmdQueue, localSize, a, d_X, d_Y, n, d_Z, nWait, waitList, done);
+}
+
+// For COPY and POOLED: h_X, h_Y, and h_Z are ordinary host arrays
+void doTheKernelLaunch(OpenCLRuntime& rt, TransferMode mode, double a, const double* h_X, const double* h_Y, size_t n, double* h_Z)
+{
+	// The context, command queue, and program all come from the runtime;
+	// they are created once per process, not once per launch.
+	cl_command_queue cmdQueue = rt.queue();
+
+	// ---------------------------------------------------------
+	// Create (or reuse) device buffers associated with the context
+	// ---------------------------------------------------------
+
+	size_t datasize = n * sizeof(double);
+
+	MemHandle bufferX, bufferY, bufferZ;
+	PooledBuffer pooledX, pooledY, pooledZ;
+	if (mode == POOLED)
+	{
+		pooledX = rt.acquireBuffer(datasize);
+		pooledY = rt.acquireBuffer(datasize);
+		pooledZ = rt.acquireBuffer(datasize);
+	}
+	else
+	{
+		bufferX = rt.createBuffer(CL_MEM_READ_ONLY, datasize);  // Input array on the device
+		bufferY = rt.createBuffer(CL_MEM_READ_ONLY, datasize);  // Input array on the device
+		bufferZ = rt.createBuffer(CL_MEM_WRITE_ONLY, datasize); // Output array on the device
+	}
+	cl_mem d_X = (mode == POOLED) ? pooledX.get() : bufferX.get();
+	cl_mem d_Y = (mode == POOLED) ? pooledY.get() : bufferY.get();
+	cl_mem d_Z = (mode == POOLED) ? pooledZ.get() : bufferZ.get();
+
+	// ------------------------------------------------------
+	// Use the command queue to encode requests to write host
+	// data to the device buffers
+	// ------------------------------------------------------
+
+	cl_int status = clEnqueueWriteBuffer(cmdQueue, 
+		d_X, CL_FALSE, 0, datasize,                         
+		h_X, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+
+	status = clEnqueueWriteBuffer(cmdQueue, 
+		d_Y, CL_FALSE, 0, datasize,                                  
+		h_Y, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+
+	enqueueDaxpy(rt, cmdQueue, daxpyLocalSize(rt, n), a, d_X, d_Y, n, d_Z);
+
+	// ----------------------------------------------------
+	// Read the output buffer back to the host
+	// ----------------------------------------------------
+
+	status = clEnqueueReadBuffer(cmdQueue, 
+		d_Z, CL_TRUE, 0, datasize, 
+		h_Z, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+
+	// The buffers are released (or returned to the pool) as their
+	// handles go out of scope
+}
+
+// For ZERO_COPY: the arrays must be unmapped; the kernel reads and writes
+// them in place, and h_Z is left mapped for reading.
+void doTheKernelLaunch(OpenCLRuntime& rt, double a, HostArray<double>& h_X, HostArray<double>& h_Y,
+	size_t n, HostArray<double>& h_Z)
+{
+	enqueueDaxpy(rt, rt.queue(), daxpyLocalSize(rt, n), a, h_X.buffer(), h_Y.buffer(), n, h_Z.buffer());
+	h_Z.map(CL_MAP_READ); // blocks until the kernel is done
+}
+
+// Every element of Z should be a*X+Y; with the small integers used here,
+// exactly. Reports and returns the number that are not.
+size_t countWrong(double a, const double* X, const double* Y, size_t n, const double* Z)
+{
+	size_t nWrong = 0;
+	for (size_t i=0 ; i<n ; i++)
+		if (Z[i] != a * X[i] + Y[i])
+			nWrong++;
+	if (nWrong != 0)
+		std::cout << "WRONG: " << nWrong << " of " << n << " results\n";
+	return nWrong;
+}
+
+// Returns false if any of the n results is wrong
+bool do_daxpy(OpenCLRuntime& rt, TransferMode mode, size_t n)
+{
+	double a = 2.0;
+	if (mode == ZERO_COPY)
+	{
+		HostArray<double> hX(rt, n), hY(rt, n), hZ(rt, n);
+		double* X = hX.map(CL_MAP_WRITE);
+		double* Y = hY.map(CL_MAP_WRITE);
+		for (size_t i=0 ; i<n ; i++)
+		{
+			X[i] = 1000.0;
+			Y[i] =   10.0;
+		}
+		hX.unmap();
+		hY.unmap();
+		doTheKernelLaunch(rt, a, hX, hY, n, hZ);
+		X = hX.map(CL_MAP_READ);
+		Y = hY.map(CL_MAP_READ);
+		double* Z = hZ.data();
+		for (size_t i=0 ; i<n && i<20 ; i++)
+			std::cout << Z[i] << " = " << a << " * " << X[i] << "  +  " << Y[i] << '\n';
+		return countWrong(a, X, Y, n, Z) == 0; // HostArrays unmap themselves when they go away
+	}
+
+	double* X = new double[n];
+	double* Y = new double[n];
+	double* Z = new double[n];
+	for (size_t i=0 ; i<n ; i++)
+	{
+		X[i] = 1000.0;
+		Y[i] =   10.0;
+		Z[i] = -999.99;
+	}
+	doTheKernelLaunch(rt, mode, a, X, Y, n, Z);
+	for (size_t i=0 ; i<n && i<20 ; i++)
+		std::cout << Z[i] << " = " << a << " * " << X[i] << "  +  " << Y[i] << '\n';
+	bool ok = countWrong(a, X, Y, n, Z) == 0;
+	delete [] X;
+	delete [] Y;
+	delete [] Z;
+	return ok;
+}
+
+// daxpy on the host (see HostCompute.h), for when there is no OpenCL
+// device or n is too small to pay for a launch. Returns false if any of
+// the n results is wrong.
+bool do_hostDaxpy(size_t n)
+{
+	double a = 2.0;
+	std::vector<double> X(n, 1000.0), Y(n, 10.0), Z(n, -999.99);
+	std::cout << "Computing on the host (" << hostSimdName(hostSimdLevel()) << ", "
+	          << ThreadPool::get().size() << " threads)\n";
+	auto start = std::chrono::steady_clock::now();
+	hostDaxpy(a, X.data(), Y.data(), n, Z.data());
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	for (size_t i=0 ; i<n && i<20 ; i++)
+		std::cout << Z[i] << " = " << a << " * " << X[i] << "  +  " << Y[i] << '\n';
+	std::cout << n << " elements in " << (elapsed.count() * 1.0e3) << " ms\n";
+	return countWrong(a, X.data(), Y.data(), n, Z.data()) == 0;
+}
+
+// Times the kernel on n elements with each work-group size it can use on
+// this device, and saves the fastest for later launches (see Autotuner.h).
+void tuneDaxpy(OpenCLRuntime& rt, size_t n)
+{
+	QueueHandle profilingQueue = rt.createQueue(CL_QUEUE_PROFILING_ENABLE);
+	size_t datasize = n * sizeof(double);
+	PooledBuffer d_X = rt.acquireBuffer(datasize);
+	PooledBuffer d_Y = rt.acquireBuffer(datasize);
+	PooledBuffer d_Z = rt.acquireBuffer(datasize);
+	std::vector<double> ones(n, 1.0);
+	cl_int status = clEnqueueWriteBuffer(profilingQueue, d_X, CL_FALSE, 0, datasize, ones.data(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-X", status, true);
+	status = clEnqueueWriteBuffer(profilingQueue, d_Y, CL_TRUE, 0, datasize, ones.data(), 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-Y", status, true);
+
+	double a = 2.0;
+	cl_kernel kernel = rt.kernel("daxpy.cl", "daxpy");
+	autotune(rt.device(), "daxpy.cl:daxpy", n, candidateLocalSizes(kernel, rt.device(), 1),
+		[&](const LaunchConfig& config)
+		{
+			// Best of 5 kernel times, after one warm-up launch
+			double best = -1.0;
+			for (int rep=0 ; rep<=5 ; rep++)
+			{
+				cl_event ev;
+				enqueueDaxpy(rt, profilingQueue, config.local[0], a, d_X, d_Y, n, d_Z, 0, nullptr, &ev);
+				EventHandle done(ev);
+				clWaitForEvents(1, &ev);
+				double seconds = profiledMilliseconds(ev) * 1.0e-3;
+				if ((rep > 0) && ((best < 0.0) || (seconds < best)))
+					best = seconds;
+			}
+			return best;
+		});
+}
+
+// ---------------------------------------------------------------------
+// Streaming: vectors too large for the device (or for one buffer) are
+// processed in chunks. Each of "nSlots" slots has its own X, Y, and Z
+// device buffers; chunk c uses slot c % nSlots. Uploads, kernels, and
+// downloads go to three separate in-order queues, tied together with
+// events, so while chunk c is computing, chunk c+1 can be uploading and
+// chunk c-1 downloading.
+// ---------------------------------------------------------------------
+
+// The largest chunk (in elements) for which nSlots sets of three buffers
+// fit comfortably in CL_DEVICE_GLOBAL_MEM_SIZE
+size_t chooseChunkElements(OpenCLRuntime& rt, int nSlots, size_t elementSize)
+{
+	cl_ulong globalMem, maxAlloc;
+	clGetDeviceInfo(rt.device(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, nullptr);
+	clGetDeviceInfo(rt.device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, nullptr);
+	// Leave half the device for everything else (and the driver's own use)
+	cl_ulong bufferBytes = std::min<cl_ulong>(globalMem / 2 / (3 * nSlots), maxAlloc);
+	// Pooled buffers can be up to 25% bigger than requested
+	bufferBytes = bufferBytes * 4 / 5;
+	// The kernel's "n" is an int
+	size_t chunk = std::min<cl_ulong>(bufferBytes / elementSize, INT_MAX);
+	// Keep chunk boundaries on page boundaries of the host arrays
+	size_t align = 4096 / elementSize;
+	if (chunk > align)
+		chunk -= chunk % align;
+	return std::max<size_t>(chunk, 1);
+}
+
+// Z = a*X + Y for arrays of any length. Returns the elapsed time in seconds.
+double streamDaxpy(OpenCLRuntime& rt, double a, const double* h_X, const double* h_Y, size_t n, double* h_Z,
+	size_t chunkElements, int nSlots)
+{
+	QueueHandle uploadQueue = rt.createQueue();
+	QueueHandle computeQueue = rt.createQueue();
+	QueueHandle downloadQueue = rt.createQueue();
+
+	size_t chunkBytes = chunkElements * sizeof(double);
+	std::vector<PooledBuffer> d_X(nSlots), d_Y(nSlots), d_Z(nSlots);
+	for (int s=0 ; s<nSlots ; s++)
+	{
+		d_X[s] = rt.acquireBuffer(chunkBytes);
+		d_Y[s] = rt.acquireBuffer(chunkBytes);
+		d_Z[s] = rt.acquireBuffer(chunkBytes);
+	}
+	// The last kernel and download that used each slot
+	std::vector<EventHandle> kernelDone(nSlots), downloadDone(nSlots);
+	// Only the last chunk can be short, and it falls in the same size
+	// bucket or a smaller one, so one lookup does for all
+	size_t localSize = daxpyLocalSize(rt, chunkElements);
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t c=0, offset=0 ; offset<n ; c++, offset+=chunkElements)
+	{
+		int s = c % nSlots;
+		size_t m = std::min(chunkElements, n - offset);
+		size_t bytes = m * sizeof(double);
+		cl_event ev;
+
+		// X and Y of this slot may be overwritten once the slot's previous
+		// kernel has read them.
+		cl_uint nWait = kernelDone[s] ? 1 : 0;
+		cl_int status = clEnqueueWriteBuffer(uploadQueue, d_X[s], CL_FALSE, 0, bytes,
+			h_X + offset, nWait, nWait ? &kernelDone[s].get() : nullptr, nullptr);
+		checkStatus("clEnqueueWriteBuffer-X-chunk", status, true);
+		status = clEnqueueWriteBuffer(uploadQueue, d_Y[s], CL_FALSE, 0, bytes,
+			h_Y + offset, 0, nullptr, &ev);
+		checkStatus("clEnqueueWriteBuffer-Y-chunk", status, true);
+		EventHandle uploadDone(ev);
+
+		// The kernel needs both uploads (the queue is in order, so the Y
+		// upload finishing implies X is there too), and may only overwrite
+		// Z once the slot's previous download has read it.
+		cl_event kernelWait[] = { uploadDone, downloadDone[s] };
+		enqueueDaxpy(rt, computeQueue, localSize, a, d_X[s], d_Y[s], m, d_Z[s],
+			downloadDone[s] ? 2 : 1, kernelWait, &ev);
+		kernelDone[s].reset(ev);
+
+		status = clEnqueueReadBuffer(downloadQueue, d_Z[s], CL_FALSE, 0, bytes,
+			h_Z + offset, 1, &kernelDone[s].get(), &ev);
+		checkStatus("clEnqueueReadBuffer-chunk", status, true);
+		downloadDone[s].reset(ev);
+
+		// Start work on the devices that wait for a flush
+		clFlush(uploadQueue);
+		clFlush(computeQueue);
+		clFlush(downloadQueue);
+	}
+	clFinish(downloadQueue);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
+}
+
+// Runs streamDaxpy on vectors from files ("xFile", "yFile": raw arrays of
+// double in native byte order) or, if no files are given, on generated
+// vectors of length n. Z goes to "zFile" if one is given. With "verify",
+// also computes Z the single-shot way (when it fits on the device) and
+// checks that the results are bit-identical. With "tune", first tunes the
+// kernel for the chunk size. Returns false on a mismatch.
+bool do_streamDaxpy(OpenCLRuntime& rt, size_t n, size_t chunkElements, int nSlots,
+	const std::string& xFile, const std::string& yFile, const std::string& zFile, bool verify, bool tune)
+{
+	double a = 2.0;
+	std::unique_ptr<MappedFile> mappedX, mappedY, mappedZ;
+	std::vector<double> X, Y, Z;
+	const double* h_X;
+	const double* h_Y;
+	double* h_Z;
+	if (!xFile.empty() || !yFile.empty())
+	{
+		if (xFile.empty() || yFile.empty())
+		{
+			std::cerr << "Streaming from files needs both -xfile= and -yfile=\n";
+			return false;
+		}
+		mappedX.reset(new MappedFile(xFile));
+		mappedY.reset(new MappedFile(yFile));
+		if (mappedX->size() != mappedY->size())
+		{
+			std::cerr << xFile << " and " << yFile << " are not the same size\n";
+			return false;
+		}
+		mappedX->adviseSequential();
+		mappedY->adviseSequential();
+		n = mappedX->size() / sizeof(double);
+		h_X = static_cast<const double*>(mappedX->data());
+		h_Y = static_cast<const double*>(mappedY->data());
+	}
+	else
+	{
+		X.resize(n);
+		Y.resize(n);
+		for (size_t i=0 ; i<n ; i++)
+		{
+			X[i] = (i % 1000) * 0.25;
+			Y[i] = 10.0 + (i % 7);
+		}
+		h_X = X.data();
+		h_Y = Y.data();
+	}
+	if (!zFile.empty())
+	{
+		mappedZ.reset(new MappedFile(zFile, n * sizeof(double)));
+		mappedZ->adviseSequential();
+		h_Z = static_cast<double*>(mappedZ->data());
+	}
+	else
+	{
+		Z.resize(n);
+		h_Z = Z.data();
+	}
+	if (n == 0)
+		return true;
+
+	if (chunkElements == 0)
+		chunkElements = chooseChunkElements(rt, nSlots, sizeof(double));
+	chunkElements = std::min(chunkElements, n);
+	size_t nChunks = (n + chunkElements - 1) / chunkElements;
+	if (tune)
+		tuneDaxpy(rt, chunkElements);
+	std::cout << "Streaming " << n << " elements in " << nChunks << " chunks of up to "
+	          << chunkElements << " using " << nSlots << " buffer slots\n";
+
+	double seconds = streamDaxpy(rt, a, h_X, h_Y, n, h_Z, chunkElements, nSlots);
+	// X and Y go to the device, Z comes back
+	double gbs = 3.0 * n * sizeof(double) / seconds * 1.0e-9;
+	std::cout << "Streamed in " << seconds << " seconds: " << gbs << " GB/s sustained\n";
+	for (size_t i=0 ; i<n && i<20 ; i++)
+		std::cout << h_Z[i] << " = " << a << " * " << h_X[i] << "  +  " << h_Y[i] << '\n';
+
+	if (!verify)
+		return true;
+	cl_ulong globalMem, maxAlloc;
+	clGetDeviceInfo(rt.device(), CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(cl_ulong), &globalMem, nullptr);
+	clGetDeviceInfo(rt.device(), CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(cl_ulong), &maxAlloc, nullptr);
+	size_t datasize = n * sizeof(double);
+	if ((datasize > maxAlloc) || (3 * datasize > globalMem) || (n > INT_MAX))
+	{
+		std::cout << "Too large for the single-shot path; not verified\n";
+		return true;
+	}
+	// The chunks' buffers are no longer needed; make room for the big ones
+	rt.bufferPool().trim();
+	std::vector<double> reference(n);
+	doTheKernelLaunch(rt, COPY, a, h_X, h_Y, n, reference.data());
+	size_t nDifferent = 0;
+	for (size_t i=0 ; i<n ; i++)
+		if (memcmp(&reference[i], &h_Z[i], sizeof(double)) != 0)
+			nDifferent++;
+	if (nDifferent == 0)
+		std::cout << "Streamed results are bit-identical to single-shot results\n";
+	else
+		std::cout << "MISMATCH: " << nDifferent << " of " << n << " streamed results differ from single-shot results\n";
+	return nDifferent == 0;
+}
+
+// ---------------------------------------------------------------------
+// Multi-device: one vector split across every device on every platform
+// (see MultiDevice.h). Each device gets its own chunk-sized buffers and
+// its own kernel; a chunk is uploaded, computed, and downloaded on the
+// device's queue before the device's thread asks for the next one.
+// ---------------------------------------------------------------------
+
+// Runs "reps" times, so that later runs are split by the throughput
+// measured on earlier ones. Returns false if any result is wrong.
+bool do_multiDaxpy(cl_device_type devType, size_t n, size_t chunkElements, int subDevices, int reps, bool stealing)
+{
+	ComputeDevices owned = discoverDevices(devType, true, subDevices); // daxpy.cl needs cl_khr_fp64
+	if (owned.empty())
+	{
+		std::cout << "No devices!\n";
+		return false;
+	}
+	std::vector<ComputeDevice*> devices;
+	for (size_t d=0 ; d<owned.size() ; d++)
+	{
+		devices.push_back(owned[d].get());
+		std::cout << "Device " << d << ": " << owned[d]->name() << '\n';
+	}
+	if (n == 0)
+		return true;
+
+	double a = 2.0;
+	std::vector<double> X(n), Y(n), Z(n, -999.99);
+	for (size_t i=0 ; i<n ; i++)
+	{
+		X[i] = (i % 1000) * 0.25;
+		Y[i] = 10.0 + (i % 7);
+	}
+	// Enough chunks per device that stealing has something to take
+	if (chunkElements == 0)
+		chunkElements = std::max<size_t>(n / (16 * devices.size()), 1);
+	chunkElements = std::min(std::min(chunkElements, n), static_cast<size_t>(INT_MAX));
+
+	// Kernels and buffers are created here, one thread at a time; the
+	// device threads only set arguments and enqueue.
+	size_t chunkBytes = chunkElements * sizeof(double);
+	std::vector<cl_kernel> kernels;
+	std::vector<size_t> localSizes;
+	std::vector<MemHandle> d_X, d_Y, d_Z;
+	for (size_t d=0 ; d<devices.size() ; d++)
+	{
+		kernels.push_back(devices[d]->kernel("daxpy.cl", "daxpy"));
+		LaunchConfig config;
+		localSizes.push_back(findTunedConfig(devices[d]->device(), "daxpy.cl:daxpy", chunkElements, config) ?
+			config.local[0] : 0);
+		d_X.push_back(devices[d]->createBuffer(CL_MEM_READ_ONLY, chunkBytes));
+		d_Y.push_back(devices[d]->createBuffer(CL_MEM_READ_ONLY, chunkBytes));
+		d_Z.push_back(devices[d]->createBuffer(CL_MEM_WRITE_ONLY, chunkBytes));
+	}
+
+	WorkScheduler scheduler(devices);
+	scheduler.setStealing(stealing);
+	for (int rep=0 ; rep<reps ; rep++)
+	{
+		double seconds = scheduler.run(n, chunkElements,
+			[&](ComputeDevice& dev, size_t d, size_t begin, size_t end)
+			{
+				cl_command_queue cmdQueue = dev.queue();
+				size_t m = end - begin;
+				size_t bytes = m * sizeof(double);
+				cl_int status = clEnqueueWriteBuffer(cmdQueue, d_X[d], CL_FALSE, 0, bytes,
+					&X[begin], 0, nullptr, nullptr);
+				checkStatus("clEnqueueWriteBuffer-X-multi", status, true);
+				status = clEnqueueWriteBuffer(cmdQueue, d_Y[d], CL_FALSE, 0, bytes,
+					&Y[begin], 0, nullptr, nullptr);
+				checkStatus("clEnqueueWriteBuffer-Y-multi", status, true);
+				enqueueDaxpy(kernels[d], cmdQueue, localSizes[d], a, d_X[d], d_Y[d], m, d_Z[d]);
+				status = clEnqueueReadBuffer(cmdQueue, d_Z[d], CL_TRUE, 0, bytes,
+					&Z[begin], 0, nullptr, nullptr);
+				checkStatus("clEnqueueReadBuffer-multi", status, true);
+			});
+		double gbs = 3.0 * n * sizeof(double) / seconds * 1.0e-9;
+		std::cout << "Run " << rep << ": " << n << " elements in chunks of " << chunkElements << " on "
+		          << devices.size() << " devices in " << seconds << " seconds (" << gbs << " GB/s)\n";
+		scheduler.report();
+	}
+	for (size_t i=0 ; i<n && i<20 ; i++)
+		std::cout << Z[i] << " = " << a << " * " << X[i] << "  +  " << Y[i] << '\n';
+	return countWrong(a, X.data(), Y.data(), n, Z.data()) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	TransferMode mode = COPY;
+	size_t n = 20;
+	bool stream = false, verify = false, tune = false;
+	bool multi = false, stealing = true;
+	int subDevices = 0, reps = 3;
+	size_t chunkElements = 0; // 0: size chunks from the device's global memory
+	int nSlots = 2;
+	std::string xFile, yFile, zFile;
+	if (argc > 1)
+	{
+		for (int i=1 ; i<argc ; i++)
+		{
+			if (strcmp("-debug", argv[i]) == 0)
+				debug = true;
+			else if (strcmp("-pooled", argv[i]) == 0)
+				mode = POOLED;
+			else if (strcmp("-zerocopy", argv[i]) == 0)
+				mode = ZERO_COPY;
+			else if (strcmp("-stream", argv[i]) == 0)
+				stream = true;
+			else if (strcmp("-verify", argv[i]) == 0)
+				verify = true;
+			else if (strcmp("-tune", argv[i]) == 0)
+				tune = true;
+			else if (strcmp("-multi", argv[i]) == 0)
+				multi = true;
+			else if (strcmp("-nosteal", argv[i]) == 0)
+				stealing = false;
+			else if (strncmp("-subdevices=", argv[i], 12) == 0)
+				subDevices = atoi(argv[i]+12);
+			else if (strncmp("-reps=", argv[i], 6) == 0)
+				reps = std::max(1, atoi(argv[i]+6));
+			else if (strncmp("-n=", argv[i], 3) == 0)
+				n = atol(argv[i]+3);
+			else if (strncmp("-chunk=", argv[i], 7) == 0)
+				chunkElements = atol(argv[i]+7);
+			else if (strncmp("-slots=", argv[i], 7) == 0)
+				nSlots = std::max(2, atoi(argv[i]+7));
+			else if (strncmp("-xfile=", argv[i], 7) == 0)
+				xFile = argv[i]+7;
+			else if (strncmp("-yfile=", argv[i], 7) == 0)
+				yFile = argv[i]+7;
+			else if (strncmp("-zfile=", argv[i], 7) == 0)
+				zFile = argv[i]+7;
+			else if (argv[i][0] == '-')
+			{
+				switch (argv[i][1])
+				{
+					case 'a':
+						devType = CL_DEVICE_TYPE_ALL;
+						break;
+					case 'c':
+						devType = CL_DEVICE_TYPE_CPU;
+						break;
+					case 'g':
+						devType = CL_DEVICE_TYPE_GPU;
+						break;
+				}
+			}
+		}
+	}
+	if (multi)
+	{
+		// Every device, unless the command line narrowed it down
+		if (devType == CL_DEVICE_TYPE_DEFAULT)
+			devType = CL_DEVICE_TYPE_ALL;
+		return do_multiDaxpy(devType, n, chunkElements, subDevices, reps, stealing) ? 0 : 1;
+	}
+
+	// A plain run on a short vector is faster on the host than the launch
+	// and the transfers (see preferHost); so is a plain run with no device.
+	// Options that ask for a device or for device behavior are never
+	// quietly run on the host.
+	bool files = !xFile.empty() || !yFile.empty() || !zFile.empty();
+	bool plain = (mode == COPY) && (devType == CL_DEVICE_TYPE_DEFAULT) && !stream && !verify && !tune && !files;
+	OpenCLRuntime* rt = nullptr;
+	if (!plain || !preferHost(3.0 * n * sizeof(double), 2.0 * n))
+		rt = OpenCLRuntime::get(devType, true); // daxpy.cl needs cl_khr_fp64
+	if (rt == nullptr)
+	{
+		if (!plain)
+		{
+			std::cerr << "-pooled, -zerocopy, -stream, -verify, -tune, -xfile/-yfile/-zfile, and -a/-c/-g need an OpenCL device\n";
+			return 1;
+		}
+		return do_hostDaxpy(n) ? 0 : 1;
+	}
+
+	lookAtDeviceLimits(rt->device());
+	lookAtKernelLimits(rt->kernel("daxpy.cl", "daxpy"), rt->device());
+
+	bool ok = true;
+	if (stream || files)
+		ok = do_streamDaxpy(*rt, n, chunkElements, nSlots, xFile, yFile, zFile, verify, tune);
+	else
+	{
+		if (tune)
+			tuneDaxpy(*rt, n);
+		ok = do_daxpy(*rt, mode, n);
+	}
+
+	std::cout << "\nBuffers created: " << allocationCounters.buffersCreated
+	          << " (" << allocationCounters.bytesCreated << " bytes), pool hits: "
+	          << allocationCounters.poolHits << ", maps: " << allocationCounters.mapCalls << '\n';
+
+	return ok ? 0 : 1;
+}
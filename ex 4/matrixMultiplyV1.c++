@@ -1,193 +1,134 @@
 // This program uses OpenCL to multiply two double precision matrices:
 // C = A * B
+//
+// With -tune, the work-group sizes the kernel can use are timed and the
+// fastest is saved in the autotuner's tuning file (see common/Autotuner.h);
+// later runs at a similar size use it.
 
 // System includes
 #include <iostream>
 #include <string>
 #include <string.h>
 #include <math.h>
+#include <chrono>
 
 // OpenCL includes
-#ifdef __APPLE__
-#include <OpenCL/opencl.h>
-#else
-#include <CL/opencl.h>
-#endif
-
-const char* readSource(const char* fileName);
-
-// A couple simple utility functions:
-bool debug = false;
-void checkStatus(std::string where, cl_int status, bool abortOnError)
-{
-	if (debug || (status != 0))
-		std::cout << "Step " << where << ", status = " << status << '\n';
-	if ((status != 0) && abortOnError)
-		exit(1);
-}
-
-void reportVersion(cl_platform_id platform)
-{
-	// Get the version of OpenCL supported on this platform
-	size_t strLength;
-	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, 0, nullptr, &strLength);
-	char* version = new char[strLength+1];
-	clGetPlatformInfo(platform, CL_PLATFORM_VERSION, strLength+1, version, &strLength);
-	std::cout << version << '\n';
-	delete [] version;
-}
-
-void showProgramBuildLog(cl_program pgm, cl_device_id dev)
+#include "OpenCLRuntime.h"
+#include "HostArray.h"
+#include "HostCompute.h"
+#include "Autotuner.h"
+
+static const char* tuningKey = "matrixMultiplyV1.cl:matrixMultiply";
+
+// Launches the kernel once with "config"'s local size and waits for it.
+// Returns the elapsed seconds, or a negative value if the launch failed
+// (only when "tuning"; otherwise a failure exits).
+double launchMatrixMultiply(OpenCLRuntime& rt, cl_mem d_A, cl_mem d_B, cl_mem d_C, size_t N,
+	const LaunchConfig& config, bool tuning)
 {
-	size_t size;
-	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, 0, nullptr, &size);
-	char* log = new char[size+1];
-	clGetProgramBuildInfo(pgm, dev, CL_PROGRAM_BUILD_LOG, size+1, log, nullptr);
-	std::cout << "LOG:\n" << log << "\n\n";
-	delete [] log;
-}
-
-// Typical OpenCL startup
+	//----------------------------------------------------------------------
+	// Get the kernel for the "__kernel" function in the ".cl" file (the
+	// program is compiled the first time it is requested)
+	//----------------------------------------------------------------------
 
-// Some global state variables (These would be better packaged as
-// instance variables of some class.)
-// 1) Platforms
-cl_uint numPlatforms = 0;
-cl_platform_id* platforms = nullptr;
-cl_platform_id curPlatform;
-// 2) Devices
-cl_uint numDevices = 0;
-cl_device_id* devices = nullptr;
+	cl_kernel kernel = rt.kernel("matrixMultiplyV1.cl", "matrixMultiply");
 
-// Return value is device index to use; -1 ==> no available devices
-int typicalOpenCLProlog(cl_device_type desiredDeviceType)
-{
-	//-----------------------------------------------------
-	// Discover and query the platforms
 	//-----------------------------------------------------
+	// Set the kernel arguments
+	//----------------------------------------------------- 
 
-	cl_int status = clGetPlatformIDs(0, nullptr, &numPlatforms);
-	checkStatus("clGetPlatformIDs-0", status, true);
-
-	platforms = new cl_platform_id[numPlatforms];
- 
-	status = clGetPlatformIDs(numPlatforms, platforms, nullptr);
-	checkStatus("clGetPlatformIDs-1", status, true);
-	curPlatform = platforms[0];
-	if (numPlatforms > 1)
-	{
-		size_t platformNameSize = 0;
-		clGetPlatformInfo(curPlatform, CL_PLATFORM_NAME, 0, nullptr, &platformNameSize);
-		char* name = new char[platformNameSize+1];
-		clGetPlatformInfo(curPlatform, CL_PLATFORM_NAME, platformNameSize+1, name, nullptr);
-		std::cout << "Found " << numPlatforms << " platforms. Arbitrarily using: " << name << '\n';
-		delete [] name;
-	}
-
-	reportVersion(curPlatform);
+	int iN = N;
+	cl_int status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A);
+	checkStatus("clSetKernelArg-A", status, true);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B);
+	checkStatus("clSetKernelArg-B", status, true);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C);
+	checkStatus("clSetKernelArg-C", status, true);
+	status = clSetKernelArg(kernel, 3, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-N", status, true);
 
-	//----------------------------------------------------------
-	// Discover and initialize the devices on a platform
-	//----------------------------------------------------------
+	//-----------------------------------------------------
+	// Configure the work-item structure. The global size is
+	// rounded up to a multiple of the local size; the kernel
+	// skips the work-items past the edges of C.
+	//----------------------------------------------------- 
 
-	status = clGetDeviceIDs(curPlatform, desiredDeviceType, 0, nullptr, &numDevices);
-	checkStatus("clGetDeviceIDs-0", status, true);
-	if (numDevices <= 0)
-	{
-		std::cout << "No devices on platform!\n";
-		return -1;
-	}
+	size_t globalWorkSize[] = { roundUpGlobal(N, config.local[0]), roundUpGlobal(N, config.local[1]) };
 
-	devices = new cl_device_id[numDevices];
+	//-----------------------------------------------------
+	// Enqueue the kernel for execution
+	//----------------------------------------------------- 
 
-	status = clGetDeviceIDs(curPlatform, desiredDeviceType, numDevices, devices, nullptr);
-	checkStatus("clGetDeviceIDs-1", status, true);
-	// Find a device that supports double precision arithmetic
-	int* possibleDevs = new int[numDevices];
-	int nPossibleDevs = 0;
-	std::cout << "\nLooking for a device that supports double precision...\n";
-	for (int idx=0 ; idx<numDevices ; idx++)
-	{
-		size_t extLength;
-		clGetDeviceInfo(devices[idx], CL_DEVICE_EXTENSIONS, 0, nullptr, &extLength);
-		char* extString = new char[extLength+1];
-		clGetDeviceInfo(devices[idx], CL_DEVICE_EXTENSIONS, extLength+1, extString, nullptr);
-		const char* fp64 = strstr(extString, "cl_khr_fp64");
-		if (fp64 != nullptr) // this device supports double precision
-			possibleDevs[nPossibleDevs++] = idx;
-	}
-	if (nPossibleDevs == 0)
-	{
-		std::cerr << "\nNo device supports double precision.\n";
-		return -1;
-	}
-	size_t nameLength;
-	for (int i=0 ; i<nPossibleDevs ; i++)
-	{
-		clGetDeviceInfo(devices[possibleDevs[i]], CL_DEVICE_NAME, 0, nullptr, &nameLength);
-		char* name = new char[nameLength+1];
-		clGetDeviceInfo(devices[possibleDevs[i]], CL_DEVICE_NAME, nameLength+1, name, nullptr);
-		std::cout << "Device " << i << ": [" << name << "] supports double precision.\n";
-	}
-	if (nPossibleDevs == 1)
-	{
-		std::cout << "\nNo other device in the requested device category supports double precision.\n"
-		          << "You may want to try the -a command line option to see if there are others.\n"
-		          << "For now, I will use the one I found.\n";
-		return possibleDevs[0];
-	}
-	int devIndex = -1;
-	while ((devIndex < 0) || (devIndex >= nPossibleDevs))
-	{
-		std::cout << "Which device do you want to use? ";
-		std::cin >> devIndex;
-	}
-	return possibleDevs[devIndex];
+	auto start = std::chrono::steady_clock::now();
+	status = clEnqueueNDRangeKernel(rt.queue(), 
+		kernel, 2, nullptr, globalWorkSize, 
+		config.localWorkSize(), 0, nullptr, nullptr);
+	if (tuning && (status != CL_SUCCESS))
+		return -1.0;
+	checkStatus("clEnqueueNDRangeKernel", status, true);
+	clFinish(rt.queue());
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count();
 }
 
-void doTheKernelLaunch(cl_device_id dev, double* A, double* B, double* C, size_t N)
+// Times the kernel with each work-group size it can use on this device
+// (best of 3, after a warm-up launch) and saves the fastest for N.
+void tuneMatrixMultiply(OpenCLRuntime& rt, cl_mem d_A, cl_mem d_B, cl_mem d_C, size_t N)
 {
-	//------------------------------------------------------------------------
-	// Create a context for some or all of the devices on the platform
-	// (Here we are including all devices.)
-	//------------------------------------------------------------------------
-
-	cl_int status;
-	cl_context context = clCreateContext(nullptr, 1, &dev, nullptr, nullptr, &status);
-	checkStatus("clCreateContext", status, true);
+	cl_kernel kernel = rt.kernel("matrixMultiplyV1.cl", "matrixMultiply");
+	autotune(rt.device(), tuningKey, N, candidateLocalSizes(kernel, rt.device(), 2),
+		[&](const LaunchConfig& config)
+		{
+			double best = -1.0;
+			for (int rep=0 ; rep<=3 ; rep++)
+			{
+				double seconds = launchMatrixMultiply(rt, d_A, d_B, d_C, N, config, true);
+				if (seconds < 0.0)
+					return -1.0;
+				if ((rep > 0) && ((best < 0.0) || (seconds < best)))
+					best = seconds;
+			}
+			return best;
+		});
+}
 
-	//-------------------------------------------------------------
-	// Create a command queue for one device in the context
-	// (There is one queue per device per context.)
-	//-------------------------------------------------------------
+// One launch with the local size saved by -tune for N (or the
+// implementation's choice if there is none); tunes first if "tune"
+void enqueueMatrixMultiply(OpenCLRuntime& rt, cl_mem d_A, cl_mem d_B, cl_mem d_C, size_t N, bool tune)
+{
+	if (tune)
+		tuneMatrixMultiply(rt, d_A, d_B, d_C, N);
+	LaunchConfig config(2);
+	findTunedConfig(rt.device(), tuningKey, N, config);
+	double seconds = launchMatrixMultiply(rt, d_A, d_B, d_C, N, config, false);
+	std::cout << "matrixMultiply: N = " << N;
+	if (config.local[0] != 0)
+		std::cout << " (local " << config.local[0] << 'x' << config.local[1] << ')';
+	std::cout << ": " << (seconds * 1.0e3) << " ms, " << (2.0 * N * N * N / seconds * 1.0e-9) << " GFLOP/s\n";
+}
 
-	cl_command_queue cmdQueue = clCreateCommandQueue(context, dev, 0, &status);
-	checkStatus("clCreateCommandQueue", status, true);
+void doTheKernelLaunch(OpenCLRuntime& rt, double* A, double* B, double* C, size_t N, bool tune)
+{
+	// The context, command queue, and program all come from the runtime;
+	// they are created once per process, not once per launch.
+	cl_command_queue cmdQueue = rt.queue();
 
 	//----------------------------------------------------------
-	// Create device buffers associated with the context
+	// Get device buffers (reused from earlier launches if possible)
 	//----------------------------------------------------------
 
 	size_t datasize = N * N * sizeof(double);
 
-	cl_mem d_A = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-A", status, true);
-
-	cl_mem d_B = clCreateBuffer( // Input array on the device
-		context, CL_MEM_READ_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-B", status, true);
-
-	cl_mem d_C = clCreateBuffer( // Output array on the device
-		context, CL_MEM_WRITE_ONLY, datasize, nullptr, &status);
-	checkStatus("clCreateBuffer-C", status, true);
+	PooledBuffer d_A = rt.acquireBuffer(datasize); // Input array on the device
+	PooledBuffer d_B = rt.acquireBuffer(datasize); // Input array on the device
+	PooledBuffer d_C = rt.acquireBuffer(datasize); // Output array on the device
 
 	//-----------------------------------------------------
 	// Use the command queue to encode requests to
 	//         write host data to the device buffers
 	//----------------------------------------------------- 
 
-	status = clEnqueueWriteBuffer(cmdQueue, 
+	cl_int status = clEnqueueWriteBuffer(cmdQueue, 
 		d_A, CL_FALSE, 0, datasize,                         
 		A, 0, nullptr, nullptr);
 	checkStatus("clEnqueueWriteBuffer-A", status, true);
@@ -197,122 +138,124 @@ void doTheKernelLaunch(cl_device_id dev, double* A, double* B, double* C, size_t
 		B, 0, nullptr, nullptr);
 	checkStatus("clEnqueueWriteBuffer-B", status, true);
 
-	//-----------------------------------------------------
-	// Create, compile, and link the program
-	//----------------------------------------------------- 
-
-	const char* programSource[] = { readSource("matrixMultiplyV1.cl") };
-	cl_program program = clCreateProgramWithSource(context, 
-		1, programSource, nullptr, &status);
-	checkStatus("clCreateProgramWithSource", status, true);
-
-	status = clBuildProgram(program, 1, &dev, nullptr, nullptr, nullptr);
-	checkStatus("clBuildProgram", status, false);
-	if (status != 0)
-		showProgramBuildLog(program, dev);
-
-	//----------------------------------------------------------------------
-	// Create a kernel using a "__kernel" function in the ".cl" file
-	//----------------------------------------------------------------------
-
-	cl_kernel kernel = clCreateKernel(program, "matrixMultiply", &status);
-
-	//-----------------------------------------------------
-	// Set the kernel arguments
-	//----------------------------------------------------- 
-
-	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A);
-	checkStatus("clSetKernelArg-A", status, true);
-	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B);
-	checkStatus("clSetKernelArg-B", status, true);
-	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C);
-	checkStatus("clSetKernelArg-C", status, true);
-	status = clSetKernelArg(kernel, 3, sizeof(int), &N);
-	checkStatus("clSetKernelArg-N", status, true);
-
-	//-----------------------------------------------------
-	// Configure the work-item structure
-	//----------------------------------------------------- 
-
-	size_t globalWorkSize[] = { N, N };    
-
-	//-----------------------------------------------------
-	// Enqueue the kernel for execution
-	//----------------------------------------------------- 
-
-	status = clEnqueueNDRangeKernel(cmdQueue, 
-		kernel, 2, nullptr, globalWorkSize, 
-		nullptr, 0, nullptr, nullptr);
-	checkStatus("clEnqueueNDRangeKernel", status, true);
+	enqueueMatrixMultiply(rt, d_A, d_B, d_C, N, tune);
 
 	//-----------------------------------------------------
 	// Read the output buffer back to the host
 	//----------------------------------------------------- 
 
-	clEnqueueReadBuffer(cmdQueue, 
+	status = clEnqueueReadBuffer(cmdQueue, 
 		d_C, CL_TRUE, 0, datasize, 
 		C, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
 
-	//-----------------------------------------------------
-	// Release OpenCL resources
-	//----------------------------------------------------- 
+	// The buffers go back to the runtime's pool as their handles go out of scope
+}
 
-	// Free OpenCL resources
-	clReleaseKernel(kernel);
-	clReleaseProgram(program);
-	clReleaseCommandQueue(cmdQueue);
-	clReleaseMemObject(d_A);
-	clReleaseMemObject(d_B);
-	clReleaseMemObject(d_C);
-	clReleaseContext(context);
-
-	// Free host resources
-	delete [] platforms;
-	delete [] devices;
+// Zero-copy version: A, B, and C must be unmapped; the kernel reads and
+// writes them in place, and C is left mapped for reading.
+void doTheKernelLaunch(OpenCLRuntime& rt, HostArray<double>& A, HostArray<double>& B,
+	HostArray<double>& C, size_t N, bool tune)
+{
+	enqueueMatrixMultiply(rt, A.buffer(), B.buffer(), C.buffer(), N, tune);
+	C.map(CL_MAP_READ);
 }
 
-double* do_MatrixMultiply(cl_device_id dev, size_t N)
+void print(std::string label, double* M, size_t N)
 {
+	std::cout << label << ":\n";
+	for (size_t row=0 ; row<N ; row++)
+	{
+		for (size_t col=0 ; col<N ; col++)
+		{
+			std::cout << M[row*N + col] << " ";
+		}
+		std::cout << '\n';
+	}
+}
+
+void do_MatrixMultiply(OpenCLRuntime& rt, size_t N, bool zeroCopy, bool tune)
+{
+	if (zeroCopy)
+	{
+		// The host arrays live in buffers the device can use directly
+		HostArray<double> hX(rt, N*N), hY(rt, N*N), hZ(rt, N*N);
+		double* X = hX.map(CL_MAP_WRITE);
+		double* Y = hY.map(CL_MAP_WRITE);
+		for (size_t row=0 ; row<N ; row++)
+			for (size_t col=0 ; col<N ; col++)
+			{
+				// make X be 2*I
+				X[row*N + col] = (row == col) ? 2.0 : 0.0;
+				Y[row*N + col] = 17.5;
+			}
+		hX.unmap();
+		hY.unmap();
+		doTheKernelLaunch(rt, hX, hY, hZ, N, tune);
+		if (N <= 20) // Larger products are not worth looking at
+			print("The product is", hZ.data(), N);
+		return;
+	}
+
 	double* X = new double[N*N];
 	double* Y = new double[N*N];
 	double* Z = new double[N*N];
-	for (int row=0 ; row<N ; row++)
-		for (int col=0 ; col<N ; col++)
+	for (size_t row=0 ; row<N ; row++)
+		for (size_t col=0 ; col<N ; col++)
 		{
 			// make X be 2*I
 			X[row*N + col] = (row == col) ? 2.0 : 0.0;
 			Y[row*N + col] = 17.5;
 		}
-	doTheKernelLaunch(dev, X, Y, Z, N);
+	doTheKernelLaunch(rt, X, Y, Z, N, tune);
+	if (N <= 20) // Larger products are not worth looking at
+		print("The product is", Z, N);
 
 	delete [] X;
 	delete [] Y;
-	return Z;
+	delete [] Z;
 }
 
-void print(std::string label, double* M, size_t N)
+// The same product on the host (see HostCompute.h), for when there is no
+// OpenCL device or N is too small to pay for a launch
+void do_hostMatrixMultiply(size_t N)
 {
-	std::cout << label << ":\n";
-	for (int row=0 ; row<N ; row++)
-	{
-		for (int col=0 ; col<N ; col++)
+	double* X = new double[N*N];
+	double* Y = new double[N*N];
+	double* Z = new double[N*N];
+	for (size_t row=0 ; row<N ; row++)
+		for (size_t col=0 ; col<N ; col++)
 		{
-			std::cout << M[row*N + col] << " ";
+			// make X be 2*I
+			X[row*N + col] = (row == col) ? 2.0 : 0.0;
+			Y[row*N + col] = 17.5;
 		}
-		std::cout << '\n';
-	}
+	std::cout << "Computing on the host (" << hostSimdName(hostSimdLevel()) << ", "
+	          << ThreadPool::get().size() << " threads)\n";
+	hostMatrixMultiply(X, Y, Z, N, N, N);
+	if (N <= 20) // Larger products are not worth looking at
+		print("The product is", Z, N);
+
+	delete [] X;
+	delete [] Y;
+	delete [] Z;
 }
 
 int main(int argc, char* argv[])
 {
 	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
 	size_t N = 20;
+	bool zeroCopy = false, tune = false;
 	if (argc > 1)
 	{
 		for (int i=1 ; i<argc ; i++)
 		{
 			if (strcmp("-debug", argv[i]) == 0)
 				debug = true;
+			else if (strcmp("-zerocopy", argv[i]) == 0)
+				zeroCopy = true;
+			else if (strcmp("-tune", argv[i]) == 0)
+				tune = true;
 			else if (argv[i][0] == '-')
 			{
 				switch (argv[i][1])
@@ -332,12 +275,22 @@ int main(int argc, char* argv[])
 				N = atoi(argv[i]);
 		}
 	}
-	int devIndex = typicalOpenCLProlog(devType);
-	if (devIndex >= 0)
+	// Matrices this small are faster on the host than the launch and the
+	// transfers (see preferHost); so is a plain run with no device. Asking
+	// for a device type, for zero-copy buffers, or for tuning always uses a
+	// device.
+	bool plain = !zeroCopy && !tune && (devType == CL_DEVICE_TYPE_DEFAULT);
+	OpenCLRuntime* rt = nullptr;
+	if (!plain || !preferHost(24.0 * N * N, 2.0 * N * N * N))
+		rt = OpenCLRuntime::get(devType, true); // needs cl_khr_fp64
+	if (rt != nullptr)
+		do_MatrixMultiply(*rt, N, zeroCopy, tune);
+	else if (plain)
+		do_hostMatrixMultiply(N);
+	else
 	{
-		double* C = do_MatrixMultiply(devices[devIndex], N);
-		print("The product is", C, N);
-		delete [] C;
+		std::cerr << "-zerocopy, -tune, and -a/-c/-g need an OpenCL device\n";
+		return 1;
 	}
 
 	return 0;
@@ -0,0 +1,472 @@
+// This program uses OpenCL to multiply two double precision matrices:
+// C = A * B
+// where A is M x K, B is K x N, and C is M x N. (Compare with
+// matrixMultiplyV1.c++, which handles only square matrices.)
+//
+// Version 2 stages TILE_SIZE x TILE_SIZE tiles of A and B in __local memory
+// so each element fetched from __global memory is used TILE_SIZE times.
+// TILE_SIZE is passed to the kernel compiler using a "-D" build option,
+// and the local work size is set to match it. With -tune, every tile size
+// the device can run is timed and the fastest is saved in the autotuner's
+// tuning file (see common/Autotuner.h); later runs at a similar size use it.
+// With -multi, blocks of rows of C are spread across every device on every
+// platform (see common/MultiDevice.h).
+
+// System includes
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+// OpenCL includes
+#include "OpenCLRuntime.h"
+#include "Autotuner.h"
+#include "HostCompute.h"
+#include "MatrixCheck.h"
+#include "MultiDevice.h"
+
+static const char* tuningKey = "matrixMultiplyV2.cl:matrixMultiplyTiled";
+
+// Do a TILE_SIZE x TILE_SIZE work-group and a pair of __local tiles fit
+// on the device?
+bool tileFitsDevice(cl_device_id dev, size_t tileSize)
+{
+	size_t mwgs;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &mwgs, nullptr);
+	size_t maxItems[3];
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_ITEM_SIZES, 3*sizeof(size_t), maxItems, nullptr);
+	cl_ulong lms;
+	clGetDeviceInfo(dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &lms, nullptr);
+
+	return (tileSize*tileSize <= mwgs) && (tileSize <= maxItems[0]) && (tileSize <= maxItems[1]) &&
+	       (2*tileSize*tileSize*sizeof(double) <= lms);
+}
+
+// Largest power-of-two tile (up to 32) that fits on the device.
+int chooseTileSize(cl_device_id dev)
+{
+	size_t tileSize = 32;
+	while ((tileSize > 1) && !tileFitsDevice(dev, tileSize))
+		tileSize /= 2;
+	return static_cast<int>(tileSize);
+}
+
+std::string buildOptions(int tileSize)
+{
+	return "-DTILE_SIZE=" + std::to_string(tileSize);
+}
+
+// The device may accept a TILE_SIZE x TILE_SIZE work-group in general, yet
+// still not for this particular kernel (e.g., due to register pressure).
+bool tileFitsKernel(OpenCLRuntime& rt, int tileSize)
+{
+	cl_kernel kernel = rt.kernel("matrixMultiplyV2.cl", "matrixMultiplyTiled", buildOptions(tileSize));
+	return static_cast<size_t>(tileSize*tileSize) <= getKernelLimits(kernel, rt.device()).maxWorkGroupSize;
+}
+
+// Returns the kernel execution time in seconds (best of "nReps" launches,
+// not counting transfers or the first "warm-up" launch).
+double doTheKernelLaunch(OpenCLRuntime& rt, double* A, double* B, double* C,
+	size_t M, size_t N, size_t K, int tileSize, int nReps)
+{
+	// The context and command queue come from the runtime; programs are
+	// compiled once per set of build options, not once per launch.
+	cl_command_queue cmdQueue = rt.queue();
+	cl_device_id dev = rt.device();
+
+	//----------------------------------------------------------
+	// Get device buffers (reused from earlier launches if possible)
+	//----------------------------------------------------------
+
+	size_t sizeA = M * K * sizeof(double);
+	size_t sizeB = K * N * sizeof(double);
+	size_t sizeC = M * N * sizeof(double);
+
+	PooledBuffer d_A = rt.acquireBuffer(sizeA); // Input array on the device
+	PooledBuffer d_B = rt.acquireBuffer(sizeB); // Input array on the device
+	PooledBuffer d_C = rt.acquireBuffer(sizeC); // Output array on the device
+
+	//-----------------------------------------------------
+	// Use the command queue to encode requests to
+	//         write host data to the device buffers
+	//-----------------------------------------------------
+
+	cl_int status = clEnqueueWriteBuffer(cmdQueue,
+		d_A, CL_FALSE, 0, sizeA,
+		A, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-A", status, true);
+
+	status = clEnqueueWriteBuffer(cmdQueue,
+		d_B, CL_FALSE, 0, sizeB,
+		B, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-B", status, true);
+
+	//----------------------------------------------------------------------
+	// Get the kernel for the "__kernel" function in the ".cl" file. The
+	// tile size is baked into the kernel with a "-D" build option.
+	//----------------------------------------------------------------------
+
+	cl_kernel kernel = rt.kernel("matrixMultiplyV2.cl", "matrixMultiplyTiled", buildOptions(tileSize));
+
+	if (!tileFitsKernel(rt, tileSize))
+	{
+		std::cerr << "Kernel max work group size (" << getKernelLimits(kernel, dev).maxWorkGroupSize << ") is too small for "
+		          << tileSize << 'x' << tileSize << " tiles. Try a smaller -tile=<n>.\n";
+		exit(1);
+	}
+
+	//-----------------------------------------------------
+	// Set the kernel arguments
+	//-----------------------------------------------------
+
+	int iM = M, iN = N, iK = K;
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+	checkStatus("clSetKernelArg-A", status, true);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+	checkStatus("clSetKernelArg-B", status, true);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+	checkStatus("clSetKernelArg-C", status, true);
+	status = clSetKernelArg(kernel, 3, sizeof(int), &iM);
+	checkStatus("clSetKernelArg-M", status, true);
+	status = clSetKernelArg(kernel, 4, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-N", status, true);
+	status = clSetKernelArg(kernel, 5, sizeof(int), &iK);
+	checkStatus("clSetKernelArg-K", status, true);
+
+	//-----------------------------------------------------
+	// Configure the work-item structure: one work-group per
+	// tile of C. The global size is rounded up so M and N
+	// need not be multiples of the tile size.
+	//-----------------------------------------------------
+
+	size_t localWorkSize[] = { (size_t)tileSize, (size_t)tileSize };
+	size_t globalWorkSize[] = { roundUpGlobal(N, tileSize), roundUpGlobal(M, tileSize) };
+
+	//-----------------------------------------------------
+	// Enqueue the kernel for execution. The first launch is
+	// a warm-up (some runtimes finish compiling on first use).
+	//-----------------------------------------------------
+
+	double bestTime = -1.0;
+	for (int rep=0 ; rep<=nReps ; rep++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		status = clEnqueueNDRangeKernel(cmdQueue,
+			kernel, 2, nullptr, globalWorkSize,
+			localWorkSize, 0, nullptr, nullptr);
+		checkStatus("clEnqueueNDRangeKernel", status, true);
+		clFinish(cmdQueue);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if ((rep > 0) && ((bestTime < 0.0) || (elapsed.count() < bestTime)))
+			bestTime = elapsed.count();
+	}
+
+	//-----------------------------------------------------
+	// Read the output buffer back to the host
+	//-----------------------------------------------------
+
+	status = clEnqueueReadBuffer(cmdQueue,
+		d_C, CL_TRUE, 0, sizeC,
+		C, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+
+	// The buffers go back to the runtime's pool as their handles go out of scope
+
+	return bestTime;
+}
+
+// C = A * B on the host (see HostCompute.h), for when there is no OpenCL
+// device or the matrices are too small to pay for a launch. Returns the
+// number of wrong elements of C.
+int do_hostMatrixMultiply(size_t M, size_t N, size_t K, int nReps)
+{
+	double* A = new double[M*K];
+	double* B = new double[K*N];
+	double* C = new double[M*N];
+	double* ref = new double[M*N];
+	fillInputs(A, B, M, N, K);
+
+	double bestTime = 0.0;
+	for (int rep=0 ; rep<nReps ; rep++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		hostMatrixMultiply(A, B, C, M, N, K);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if ((rep == 0) || (elapsed.count() < bestTime))
+			bestTime = elapsed.count();
+	}
+	double gflops = 2.0 * M * N * K / bestTime * 1.0e-9;
+	std::cout << "hostMatrixMultiply (" << hostSimdName(hostSimdLevel()) << ", " << ThreadPool::get().size()
+	          << " threads): C(" << M << 'x' << N << ") = A(" << M << 'x' << K << ") * B(" << K << 'x' << N
+	          << "): " << (bestTime * 1.0e3) << " ms, " << gflops << " GFLOP/s\n";
+
+	naiveMatrixMultiply(A, B, ref, M, N, K);
+	int nBad = compareToReference(C, ref, M, N, K);
+
+	delete [] A;
+	delete [] B;
+	delete [] C;
+	delete [] ref;
+	return nBad;
+}
+
+// Times every power-of-two tile size that fits the device and the kernel,
+// saves the fastest in the tuning file, and returns it.
+int tuneTileSize(OpenCLRuntime& rt, double* A, double* B, double* C,
+	size_t M, size_t N, size_t K, int nReps)
+{
+	std::vector<LaunchConfig> candidates;
+	for (int t=2 ; t<=64 ; t*=2)
+		if (tileFitsDevice(rt.device(), t))
+			candidates.push_back(LaunchConfig(2, t, t, 1, buildOptions(t)));
+	LaunchConfig best = autotune(rt.device(), tuningKey, std::max(M, std::max(N, K)), candidates,
+		[&](const LaunchConfig& config)
+		{
+			int tileSize = static_cast<int>(config.local[0]);
+			if (!tileFitsKernel(rt, tileSize))
+				return -1.0;
+			return doTheKernelLaunch(rt, A, B, C, M, N, K, tileSize, nReps);
+		});
+	return (best.local[0] == 0) ? chooseTileSize(rt.device()) : static_cast<int>(best.local[0]);
+}
+
+// The tile size saved by an earlier -tune for matrices of about this
+// size, or 0 if there is none.
+int tunedTileSize(OpenCLRuntime& rt, size_t M, size_t N, size_t K)
+{
+	LaunchConfig config;
+	if (findTunedConfig(rt.device(), tuningKey, std::max(M, std::max(N, K)), config))
+		return static_cast<int>(config.local[0]);
+	return 0;
+}
+
+int do_MatrixMultiply(OpenCLRuntime& rt, size_t M, size_t N, size_t K, int tileSize, bool tune, int nReps)
+{
+	double* A = new double[M*K];
+	double* B = new double[K*N];
+	double* C = new double[M*N];
+	double* ref = new double[M*N];
+	fillInputs(A, B, M, N, K);
+
+	if (tune)
+		tileSize = tuneTileSize(rt, A, B, C, M, N, K, nReps);
+	if (tileSize <= 0)
+		tileSize = tunedTileSize(rt, M, N, K);
+	if (tileSize <= 0)
+		tileSize = chooseTileSize(rt.device());
+	double seconds = doTheKernelLaunch(rt, A, B, C, M, N, K, tileSize, nReps);
+	double gflops = 2.0 * M * N * K / seconds * 1.0e-9;
+	std::cout << "matrixMultiplyTiled (TILE_SIZE=" << tileSize << "): C(" << M << 'x' << N
+	          << ") = A(" << M << 'x' << K << ") * B(" << K << 'x' << N << "): "
+	          << (seconds * 1.0e3) << " ms, " << gflops << " GFLOP/s\n";
+
+	hostMatrixMultiply(A, B, ref, M, N, K);
+	int nBad = compareToReference(C, ref, M, N, K);
+
+	delete [] A;
+	delete [] B;
+	delete [] C;
+	delete [] ref;
+	return nBad;
+}
+
+// ---------------------------------------------------------------------
+// Multi-device: each device gets all of B, and computes blocks of rows of
+// C from the matching rows of A. Each device uses its own tuned (or
+// largest fitting) tile size.
+// ---------------------------------------------------------------------
+
+// Runs "nReps" times, so that later runs are split by the throughput
+// measured on earlier ones. Returns the number of wrong elements of C, or
+// -1 if there is no device to run on.
+int do_multiMatrixMultiply(cl_device_type devType, size_t M, size_t N, size_t K, int tileSize,
+	int subDevices, int nReps)
+{
+	ComputeDevices owned = discoverDevices(devType, true, subDevices); // needs cl_khr_fp64
+	if (owned.empty())
+	{
+		std::cout << "No devices!\n";
+		return -1;
+	}
+	std::vector<ComputeDevice*> devices;
+	for (size_t d=0 ; d<owned.size() ; d++)
+		devices.push_back(owned[d].get());
+
+	double* A = new double[M*K];
+	double* B = new double[K*N];
+	double* C = new double[M*N];
+	double* ref = new double[M*N];
+	fillInputs(A, B, M, N, K);
+
+	// Enough row blocks per device that stealing has something to take
+	size_t rowsPerChunk = std::max<size_t>(M / (8 * devices.size()), 1);
+
+	// Kernels and buffers are created (and B uploaded) here, one device at
+	// a time; the device threads only set arguments and enqueue.
+	std::vector<cl_kernel> kernels;
+	std::vector<int> tileSizes;
+	std::vector<MemHandle> d_A, d_B, d_C;
+	for (size_t d=0 ; d<devices.size() ; d++)
+	{
+		ComputeDevice& dev = *devices[d];
+		int t = tileSize;
+		LaunchConfig config;
+		if ((t <= 0) && findTunedConfig(dev.device(), tuningKey, std::max(M, std::max(N, K)), config))
+			t = static_cast<int>(config.local[0]);
+		if (t <= 0)
+			t = chooseTileSize(dev.device());
+		cl_kernel kernel = dev.kernel("matrixMultiplyV2.cl", "matrixMultiplyTiled", buildOptions(t));
+		while ((t > 1) && (static_cast<size_t>(t*t) > getKernelLimits(kernel, dev.device()).maxWorkGroupSize))
+		{
+			t /= 2;
+			kernel = dev.kernel("matrixMultiplyV2.cl", "matrixMultiplyTiled", buildOptions(t));
+		}
+		kernels.push_back(kernel);
+		tileSizes.push_back(t);
+		std::cout << "Device " << d << ": " << dev.name() << ", TILE_SIZE=" << t << '\n';
+
+		d_A.push_back(dev.createBuffer(CL_MEM_READ_ONLY, rowsPerChunk * K * sizeof(double)));
+		d_B.push_back(dev.createBuffer(CL_MEM_READ_ONLY, K * N * sizeof(double)));
+		d_C.push_back(dev.createBuffer(CL_MEM_WRITE_ONLY, rowsPerChunk * N * sizeof(double)));
+		cl_int status = clEnqueueWriteBuffer(dev.queue(), d_B[d], CL_TRUE, 0, K * N * sizeof(double),
+			B, 0, nullptr, nullptr);
+		checkStatus("clEnqueueWriteBuffer-B-multi", status, true);
+	}
+
+	WorkScheduler scheduler(devices);
+	for (int rep=0 ; rep<nReps ; rep++)
+	{
+		double seconds = scheduler.run(M, rowsPerChunk,
+			[&](ComputeDevice& dev, size_t d, size_t firstRow, size_t endRow)
+			{
+				cl_command_queue cmdQueue = dev.queue();
+				cl_kernel kernel = kernels[d];
+				int t = tileSizes[d];
+				size_t rows = endRow - firstRow;
+				cl_int status = clEnqueueWriteBuffer(cmdQueue, d_A[d], CL_FALSE, 0, rows * K * sizeof(double),
+					A + firstRow*K, 0, nullptr, nullptr);
+				checkStatus("clEnqueueWriteBuffer-A-multi", status, true);
+
+				int iM = rows, iN = N, iK = K;
+				status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A[d].get());
+				checkStatus("clSetKernelArg-A", status, true);
+				status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B[d].get());
+				checkStatus("clSetKernelArg-B", status, true);
+				status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C[d].get());
+				checkStatus("clSetKernelArg-C", status, true);
+				status = clSetKernelArg(kernel, 3, sizeof(int), &iM);
+				checkStatus("clSetKernelArg-M", status, true);
+				status = clSetKernelArg(kernel, 4, sizeof(int), &iN);
+				checkStatus("clSetKernelArg-N", status, true);
+				status = clSetKernelArg(kernel, 5, sizeof(int), &iK);
+				checkStatus("clSetKernelArg-K", status, true);
+
+				size_t localWorkSize[] = { (size_t)t, (size_t)t };
+				size_t globalWorkSize[] = { roundUpGlobal(N, t), roundUpGlobal(rows, t) };
+				status = clEnqueueNDRangeKernel(cmdQueue,
+					kernel, 2, nullptr, globalWorkSize,
+					localWorkSize, 0, nullptr, nullptr);
+				checkStatus("clEnqueueNDRangeKernel", status, true);
+
+				status = clEnqueueReadBuffer(cmdQueue, d_C[d], CL_TRUE, 0, rows * N * sizeof(double),
+					C + firstRow*N, 0, nullptr, nullptr);
+				checkStatus("clEnqueueReadBuffer-C-multi", status, true);
+			});
+		// Includes transferring A and C, unlike the single-device timing
+		double gflops = 2.0 * M * N * K / seconds * 1.0e-9;
+		std::cout << "Run " << rep << ": C(" << M << 'x' << N << ") = A(" << M << 'x' << K << ") * B("
+		          << K << 'x' << N << ") in blocks of " << rowsPerChunk << " rows on " << devices.size()
+		          << " devices: " << (seconds * 1.0e3) << " ms, " << gflops << " GFLOP/s\n";
+		scheduler.report();
+	}
+
+	hostMatrixMultiply(A, B, ref, M, N, K);
+	int nBad = compareToReference(C, ref, M, N, K);
+
+	delete [] A;
+	delete [] B;
+	delete [] C;
+	delete [] ref;
+	return nBad;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	size_t dims[3] = { 20, 0, 0 }; // M, N, K; N and K default to M
+	int nDims = 0;
+	int tileSize = 0; // 0 ==> the tuned size, else the largest that fits the device
+	bool tune = false, multi = false;
+	int nReps = 3, subDevices = 0;
+	if (argc > 1)
+	{
+		for (int i=1 ; i<argc ; i++)
+		{
+			if (strcmp("-debug", argv[i]) == 0)
+				debug = true;
+			else if (strncmp("-tile=", argv[i], 6) == 0)
+				tileSize = atoi(argv[i]+6);
+			else if (strncmp("-reps=", argv[i], 6) == 0)
+				nReps = atoi(argv[i]+6);
+			else if (strcmp("-tune", argv[i]) == 0)
+				tune = true;
+			else if (strcmp("-multi", argv[i]) == 0)
+				multi = true;
+			else if (strncmp("-subdevices=", argv[i], 12) == 0)
+				subDevices = atoi(argv[i]+12);
+			else if (argv[i][0] == '-')
+			{
+				switch (argv[i][1])
+				{
+					case 'a':
+						devType = CL_DEVICE_TYPE_ALL;
+						break;
+					case 'c':
+						devType = CL_DEVICE_TYPE_CPU;
+						break;
+					case 'g':
+						devType = CL_DEVICE_TYPE_GPU;
+						break;
+				}
+			}
+			else if (nDims < 3)
+				dims[nDims++] = atoi(argv[i]);
+		}
+	}
+	size_t M = dims[0];
+	size_t N = (nDims > 1) ? dims[1] : M;
+	size_t K = (nDims > 2) ? dims[2] : M;
+	if (nReps < 1)
+		nReps = 1;
+
+	if (multi)
+	{
+		// Every device, unless the command line narrowed it down
+		if (devType == CL_DEVICE_TYPE_DEFAULT)
+			devType = CL_DEVICE_TYPE_ALL;
+		return (do_multiMatrixMultiply(devType, M, N, K, tileSize, subDevices, nReps) == 0) ? 0 : 1;
+	}
+
+	// Matrices this small are faster on the host than the launch and the
+	// transfers (see preferHost); so is a plain run with no device. Asking
+	// for a device type or for kernel settings always uses a device.
+	bool plain = !tune && (devType == CL_DEVICE_TYPE_DEFAULT) && (tileSize <= 0);
+	OpenCLRuntime* rt = nullptr;
+	if (!plain || !preferHost(8.0 * (M*K + K*N + M*N), 2.0 * M * N * K))
+		rt = OpenCLRuntime::get(devType, true); // needs cl_khr_fp64
+	if (rt == nullptr)
+	{
+		if (!plain)
+		{
+			std::cerr << "-tune, -tile=, and -a/-c/-g need an OpenCL device\n";
+			return 1;
+		}
+		return (do_hostMatrixMultiply(M, N, K, nReps) == 0) ? 0 : 1;
+	}
+
+	int nBad = do_MatrixMultiply(*rt, M, N, K, tileSize, tune, nReps);
+
+	return (nBad == 0) ? 0 : 1;
+}
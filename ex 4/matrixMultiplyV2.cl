@@ -0,0 +1,44 @@
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+// TILE_SIZE is normally supplied at build time (e.g., "-DTILE_SIZE=16").
+// Each work-group is TILE_SIZE x TILE_SIZE work-items and computes one
+// TILE_SIZE x TILE_SIZE tile of C.
+#ifndef TILE_SIZE
+#define TILE_SIZE 16
+#endif
+
+// C (M x N) = A (M x K) * B (K x N); all matrices stored in row-major order.
+// The global size is rounded up to a multiple of TILE_SIZE in each dimension,
+// so work-items outside C load zeros and store nothing.
+__kernel
+void matrixMultiplyTiled(__global const double* A, __global const double* B, __global double* C,
+	int M, int N, int K)
+{
+	__local double Atile[TILE_SIZE][TILE_SIZE];
+	__local double Btile[TILE_SIZE][TILE_SIZE];
+
+	int localCol = get_local_id(0);
+	int localRow = get_local_id(1);
+	int col = get_global_id(0);
+	int row = get_global_id(1);
+
+	double sum = 0.0;
+	int numTiles = (K + TILE_SIZE - 1) / TILE_SIZE;
+	for (int t=0 ; t<numTiles ; t++)
+	{
+		// Each work-item brings in one element of A and one of B. Adjacent
+		// work-items (in dimension 0) read adjacent addresses of both.
+		int aCol = t*TILE_SIZE + localCol;
+		int bRow = t*TILE_SIZE + localRow;
+		Atile[localRow][localCol] = ((row < M) && (aCol < K)) ? A[row*K + aCol] : 0.0;
+		Btile[localRow][localCol] = ((bRow < K) && (col < N)) ? B[bRow*N + col] : 0.0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int k=0 ; k<TILE_SIZE ; k++)
+			sum += Atile[localRow][k] * Btile[k][localCol];
+		// Don't let anyone overwrite the tiles until everyone is done with them
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+	if ((row < M) && (col < N))
+		C[row*N + col] = sum;
+}
@@ -0,0 +1,443 @@
+// This program uses OpenCL to multiply two double precision matrices:
+// C = A * B
+// where A is M x K, B is K x N, and C is M x N. (Compare with
+// matrixMultiplyV1.c++, which handles only square matrices.)
+//
+// Version 3 offers two alternatives to the tiled kernel of version 2:
+//  1) "blocked": the same __local tiling, but each work-item computes WPT
+//     elements of C, keeping the partial sums in registers. TILE_SIZE and
+//     WPT are passed to the kernel compiler using "-D" build options, and
+//     the local work size is set to match them.
+//  2) "bt": B is transposed on the host before it is sent to the device, so
+//     each work-item reads a row of A and a row of B-transposed, both with
+//     unit stride. This generally suits CPU devices best.
+// Both are run by default; use -blocked or -bt to run just one.
+//
+// With -tune, the program times every (TILE_SIZE, WPT) pair the device can
+// run for "blocked", and every legal local size for "bt", and saves the
+// fastest of each in the autotuner's tuning file (see common/Autotuner.h).
+// Later runs at a similar size use them unless -tile= or -wpt= is given.
+
+// System includes
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <algorithm>
+
+// OpenCL includes
+#include "OpenCLRuntime.h"
+#include "Autotuner.h"
+#include "HostCompute.h"
+#include "MatrixCheck.h"
+
+static const char* blockedTuningKey = "matrixMultiplyV3.cl:matrixMultiplyBlocked";
+static const char* btTuningKey = "matrixMultiplyV3.cl:matrixMultiplyTransposedB";
+
+enum Variant { BLOCKED, TRANSPOSED_B };
+
+// Do a TILE_SIZE x (TILE_SIZE/WPT) work-group and a pair of __local tiles
+// fit on the device?
+bool tileFitsDevice(cl_device_id dev, size_t tileSize, size_t wpt)
+{
+	size_t mwgs;
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &mwgs, nullptr);
+	size_t maxItems[3];
+	clGetDeviceInfo(dev, CL_DEVICE_MAX_WORK_ITEM_SIZES, 3*sizeof(size_t), maxItems, nullptr);
+	cl_ulong lms;
+	clGetDeviceInfo(dev, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &lms, nullptr);
+
+	return (tileSize*tileSize/wpt <= mwgs) && (tileSize <= maxItems[0]) && (tileSize/wpt <= maxItems[1]) &&
+	       (2*tileSize*tileSize*sizeof(double) <= lms);
+}
+
+// Largest power-of-two tile (up to 64) that fits on the device.
+int chooseTileSize(cl_device_id dev, int wpt)
+{
+	size_t tileSize = 64;
+	while ((tileSize > static_cast<size_t>(wpt)) && !tileFitsDevice(dev, tileSize, wpt))
+		tileSize /= 2;
+	return static_cast<int>(tileSize);
+}
+
+std::string buildOptions(int tileSize, int wpt)
+{
+	return "-DTILE_SIZE=" + std::to_string(tileSize) + " -DWPT=" + std::to_string(wpt);
+}
+
+// The device may accept the work-group in general, yet still not for the
+// "blocked" kernel (e.g., due to register pressure).
+bool tileFitsKernel(OpenCLRuntime& rt, int tileSize, int wpt)
+{
+	cl_kernel kernel = rt.kernel("matrixMultiplyV3.cl", "matrixMultiplyBlocked", buildOptions(tileSize, wpt));
+	return static_cast<size_t>(tileSize*tileSize/wpt) <= getKernelLimits(kernel, rt.device()).maxWorkGroupSize;
+}
+
+// Returns the kernel execution time in seconds (best of "nReps" launches,
+// not counting transfers or the first "warm-up" launch). "btConfig" gives
+// the local size for the "bt" kernel; "blocked" uses tileSize and wpt.
+double doTheKernelLaunch(OpenCLRuntime& rt, Variant variant, double* A, double* B, double* C,
+	size_t M, size_t N, size_t K, int tileSize, int wpt, const LaunchConfig& btConfig, int nReps)
+{
+	// The context and command queue come from the runtime; programs are
+	// compiled once per set of build options, not once per launch.
+	cl_command_queue cmdQueue = rt.queue();
+	cl_device_id dev = rt.device();
+
+	//----------------------------------------------------------
+	// Get device buffers (reused from earlier launches if possible)
+	//----------------------------------------------------------
+
+	size_t sizeA = M * K * sizeof(double);
+	size_t sizeB = K * N * sizeof(double);
+	size_t sizeC = M * N * sizeof(double);
+
+	PooledBuffer d_A = rt.acquireBuffer(sizeA); // Input array on the device
+	PooledBuffer d_B = rt.acquireBuffer(sizeB); // Input array on the device
+	PooledBuffer d_C = rt.acquireBuffer(sizeC); // Output array on the device
+
+	//-----------------------------------------------------
+	// Use the command queue to encode requests to
+	//         write host data to the device buffers
+	//-----------------------------------------------------
+
+	// The "bt" kernel wants B in column-major order (i.e., B transposed)
+	double* BT = nullptr;
+	if (variant == TRANSPOSED_B)
+	{
+		BT = new double[N*K];
+		for (size_t k=0 ; k<K ; k++)
+			for (size_t col=0 ; col<N ; col++)
+				BT[col*K + k] = B[k*N + col];
+	}
+
+	cl_int status = clEnqueueWriteBuffer(cmdQueue,
+		d_A, CL_FALSE, 0, sizeA,
+		A, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-A", status, true);
+
+	status = clEnqueueWriteBuffer(cmdQueue,
+		d_B, CL_FALSE, 0, sizeB,
+		(BT == nullptr) ? B : BT, 0, nullptr, nullptr);
+	checkStatus("clEnqueueWriteBuffer-B", status, true);
+
+	//----------------------------------------------------------------------
+	// Get the kernel for the "__kernel" function in the ".cl" file. The
+	// tile size and work per work-item are baked into the kernel with
+	// "-D" build options.
+	//----------------------------------------------------------------------
+
+	const char* kernelName = (variant == BLOCKED) ? "matrixMultiplyBlocked" : "matrixMultiplyTransposedB";
+	cl_kernel kernel = rt.kernel("matrixMultiplyV3.cl", kernelName, buildOptions(tileSize, wpt));
+
+	if (variant == BLOCKED)
+	{
+		if (!tileFitsKernel(rt, tileSize, wpt))
+		{
+			std::cerr << "Kernel max work group size (" << getKernelLimits(kernel, dev).maxWorkGroupSize << ") is too small for "
+			          << tileSize << 'x' << (tileSize/wpt) << " work-groups. Try a smaller -tile=<n>"
+			          << " or a larger -wpt=<n>.\n";
+			exit(1);
+		}
+	}
+
+	//-----------------------------------------------------
+	// Set the kernel arguments
+	//-----------------------------------------------------
+
+	int iM = M, iN = N, iK = K;
+	status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &d_A.get());
+	checkStatus("clSetKernelArg-A", status, true);
+	status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &d_B.get());
+	checkStatus("clSetKernelArg-B", status, true);
+	status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &d_C.get());
+	checkStatus("clSetKernelArg-C", status, true);
+	status = clSetKernelArg(kernel, 3, sizeof(int), &iM);
+	checkStatus("clSetKernelArg-M", status, true);
+	status = clSetKernelArg(kernel, 4, sizeof(int), &iN);
+	checkStatus("clSetKernelArg-N", status, true);
+	status = clSetKernelArg(kernel, 5, sizeof(int), &iK);
+	checkStatus("clSetKernelArg-K", status, true);
+
+	//-----------------------------------------------------
+	// Configure the work-item structure. For "blocked", one
+	// work-group per tile of C, each work-item covering WPT
+	// rows; the global size is rounded up so M and N need
+	// not be multiples of the tile size. The "bt" kernel
+	// uses no local memory; it gets the tuned local size
+	// if there is one, and otherwise the driver chooses.
+	//-----------------------------------------------------
+
+	size_t localWorkSize[] = { (size_t)tileSize, (size_t)(tileSize/wpt) };
+	size_t globalWorkSize[] = { roundUpGlobal(N, tileSize), roundUpGlobal(M, tileSize) / wpt };
+	const size_t* local = localWorkSize;
+	if (variant == TRANSPOSED_B)
+	{
+		globalWorkSize[0] = roundUpGlobal(N, btConfig.local[0]);
+		globalWorkSize[1] = roundUpGlobal(M, btConfig.local[1]);
+		local = btConfig.localWorkSize();
+	}
+
+	//-----------------------------------------------------
+	// Enqueue the kernel for execution. The first launch is
+	// a warm-up (some runtimes finish compiling on first use).
+	//-----------------------------------------------------
+
+	double bestTime = -1.0;
+	for (int rep=0 ; rep<=nReps ; rep++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		status = clEnqueueNDRangeKernel(cmdQueue,
+			kernel, 2, nullptr, globalWorkSize,
+			local, 0, nullptr, nullptr);
+		checkStatus("clEnqueueNDRangeKernel", status, true);
+		clFinish(cmdQueue);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if ((rep > 0) && ((bestTime < 0.0) || (elapsed.count() < bestTime)))
+			bestTime = elapsed.count();
+	}
+
+	//-----------------------------------------------------
+	// Read the output buffer back to the host
+	//-----------------------------------------------------
+
+	status = clEnqueueReadBuffer(cmdQueue,
+		d_C, CL_TRUE, 0, sizeC,
+		C, 0, nullptr, nullptr);
+	checkStatus("clEnqueueReadBuffer", status, true);
+
+	// The buffers go back to the runtime's pool as their handles go out of scope
+	delete [] BT;
+
+	return bestTime;
+}
+
+// C = A * B on the host (see HostCompute.h), for when there is no OpenCL
+// device or the matrices are too small to pay for a launch. Returns the
+// number of wrong elements of C.
+int do_hostMatrixMultiply(size_t M, size_t N, size_t K, int nReps)
+{
+	double* A = new double[M*K];
+	double* B = new double[K*N];
+	double* C = new double[M*N];
+	double* ref = new double[M*N];
+	fillInputs(A, B, M, N, K);
+
+	double bestTime = 0.0;
+	for (int rep=0 ; rep<nReps ; rep++)
+	{
+		auto start = std::chrono::steady_clock::now();
+		hostMatrixMultiply(A, B, C, M, N, K);
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		if ((rep == 0) || (elapsed.count() < bestTime))
+			bestTime = elapsed.count();
+	}
+	double gflops = 2.0 * M * N * K / bestTime * 1.0e-9;
+	std::cout << "hostMatrixMultiply (" << hostSimdName(hostSimdLevel()) << ", " << ThreadPool::get().size()
+	          << " threads): C(" << M << 'x' << N << ") = A(" << M << 'x' << K << ") * B(" << K << 'x' << N
+	          << "): " << (bestTime * 1.0e3) << " ms, " << gflops << " GFLOP/s\n";
+
+	naiveMatrixMultiply(A, B, ref, M, N, K);
+	int nBad = compareToReference(C, ref, M, N, K);
+
+	delete [] A;
+	delete [] B;
+	delete [] C;
+	delete [] ref;
+	return nBad;
+}
+
+// Times "blocked" with every (TILE_SIZE, WPT) pair that fits the device and
+// the kernel, saves the fastest in the tuning file, and sets tileSize and
+// wpt to it.
+void tuneBlocked(OpenCLRuntime& rt, double* A, double* B, double* C,
+	size_t M, size_t N, size_t K, int nReps, int& tileSize, int& wpt)
+{
+	LaunchConfig noBT(2);
+	std::vector<LaunchConfig> candidates;
+	for (int t=8 ; t<=64 ; t*=2)
+		for (int w=1 ; (w<=8) && (w<=t) ; w*=2)
+			if (tileFitsDevice(rt.device(), t, w))
+				candidates.push_back(LaunchConfig(2, t, t/w, 1, buildOptions(t, w)));
+	LaunchConfig best = autotune(rt.device(), blockedTuningKey, std::max(M, std::max(N, K)), candidates,
+		[&](const LaunchConfig& config)
+		{
+			int t = static_cast<int>(config.local[0]);
+			int w = t / static_cast<int>(config.local[1]);
+			if (!tileFitsKernel(rt, t, w))
+				return -1.0;
+			return doTheKernelLaunch(rt, BLOCKED, A, B, C, M, N, K, t, w, noBT, nReps);
+		});
+	if (best.local[0] != 0)
+	{
+		tileSize = static_cast<int>(best.local[0]);
+		wpt = tileSize / static_cast<int>(best.local[1]);
+	}
+}
+
+// Times "bt" with every local size it can use, saves the fastest in the
+// tuning file, and returns it.
+LaunchConfig tuneTransposedB(OpenCLRuntime& rt, double* A, double* B, double* C,
+	size_t M, size_t N, size_t K, int tileSize, int wpt, int nReps)
+{
+	cl_kernel kernel = rt.kernel("matrixMultiplyV3.cl", "matrixMultiplyTransposedB", buildOptions(tileSize, wpt));
+	return autotune(rt.device(), btTuningKey, std::max(M, std::max(N, K)),
+		candidateLocalSizes(kernel, rt.device(), 2),
+		[&](const LaunchConfig& config)
+		{
+			return doTheKernelLaunch(rt, TRANSPOSED_B, A, B, C, M, N, K, tileSize, wpt, config, nReps);
+		});
+}
+
+int do_MatrixMultiply(OpenCLRuntime& rt, bool runBlocked, bool runBT,
+	size_t M, size_t N, size_t K, int tileSize, int wpt, bool tune, int nReps)
+{
+	double* A = new double[M*K];
+	double* B = new double[K*N];
+	double* C = new double[M*N];
+	double* ref = new double[M*N];
+	fillInputs(A, B, M, N, K);
+	hostMatrixMultiply(A, B, ref, M, N, K);
+
+	// Explicit -tile= and -wpt= win; then what -tune finds (now or in an
+	// earlier run); then the largest tile that fits, with WPT=4.
+	size_t problemSize = std::max(M, std::max(N, K));
+	LaunchConfig tuned, btConfig(2);
+	if (tune && runBlocked && (tileSize <= 0) && (wpt <= 0))
+		tuneBlocked(rt, A, B, C, M, N, K, nReps, tileSize, wpt);
+	else if ((tileSize <= 0) && (wpt <= 0) && findTunedConfig(rt.device(), blockedTuningKey, problemSize, tuned))
+	{
+		tileSize = static_cast<int>(tuned.local[0]);
+		wpt = tileSize / static_cast<int>(tuned.local[1]);
+	}
+	if (wpt <= 0)
+		wpt = 4;
+	if (tileSize <= 0)
+		tileSize = chooseTileSize(rt.device(), wpt);
+	// Each work-item covers WPT rows of a tile, so WPT must divide the tile
+	// size (which also keeps it no larger than the tile)
+	if (tileSize % wpt != 0)
+	{
+		std::cerr << "WPT (" << wpt << ") must divide the tile size (" << tileSize << ").\n";
+		delete [] A;
+		delete [] B;
+		delete [] C;
+		delete [] ref;
+		return 1;
+	}
+	if (tune && runBT)
+		btConfig = tuneTransposedB(rt, A, B, C, M, N, K, tileSize, wpt, nReps);
+	else if (findTunedConfig(rt.device(), btTuningKey, problemSize, tuned))
+		btConfig = tuned;
+
+	int nBad = 0;
+	for (int v=0 ; v<2 ; v++)
+	{
+		Variant variant = (v == 0) ? BLOCKED : TRANSPOSED_B;
+		if (((variant == BLOCKED) && !runBlocked) || ((variant == TRANSPOSED_B) && !runBT))
+			continue;
+		for (size_t i=0 ; i<M*N ; i++)
+			C[i] = -999.99;
+		double seconds = doTheKernelLaunch(rt, variant, A, B, C, M, N, K, tileSize, wpt, btConfig, nReps);
+		double gflops = 2.0 * M * N * K / seconds * 1.0e-9;
+		if (variant == BLOCKED)
+			std::cout << "matrixMultiplyBlocked (TILE_SIZE=" << tileSize << ", WPT=" << wpt << ")";
+		else
+		{
+			std::cout << "matrixMultiplyTransposedB";
+			if (btConfig.local[0] != 0)
+				std::cout << " (local " << btConfig.local[0] << 'x' << btConfig.local[1] << ")";
+		}
+		std::cout << ": C(" << M << 'x' << N << ") = A(" << M << 'x' << K << ") * B(" << K << 'x' << N
+		          << "): " << (seconds * 1.0e3) << " ms, " << gflops << " GFLOP/s\n";
+		nBad += compareToReference(C, ref, M, N, K);
+	}
+
+	delete [] A;
+	delete [] B;
+	delete [] C;
+	delete [] ref;
+	return nBad;
+}
+
+int main(int argc, char* argv[])
+{
+	cl_device_type devType = CL_DEVICE_TYPE_DEFAULT;
+	size_t dims[3] = { 20, 0, 0 }; // M, N, K; N and K default to M
+	int nDims = 0;
+	int tileSize = 0; // 0 ==> the tuned size, else the largest that fits the device
+	int wpt = 0;      // 0 ==> the tuned value, else 4
+	bool tune = false;
+	int nReps = 3;
+	bool runBlocked = true, runBT = true;
+	if (argc > 1)
+	{
+		for (int i=1 ; i<argc ; i++)
+		{
+			if (strcmp("-debug", argv[i]) == 0)
+				debug = true;
+			else if (strcmp("-blocked", argv[i]) == 0)
+				runBT = false;
+			else if (strcmp("-bt", argv[i]) == 0)
+				runBlocked = false;
+			else if (strncmp("-tile=", argv[i], 6) == 0)
+				tileSize = atoi(argv[i]+6);
+			else if (strncmp("-wpt=", argv[i], 5) == 0)
+				wpt = atoi(argv[i]+5);
+			else if (strncmp("-reps=", argv[i], 6) == 0)
+				nReps = atoi(argv[i]+6);
+			else if (strcmp("-tune", argv[i]) == 0)
+				tune = true;
+			else if (argv[i][0] == '-')
+			{
+				switch (argv[i][1])
+				{
+					case 'a':
+						devType = CL_DEVICE_TYPE_ALL;
+						break;
+					case 'c':
+						devType = CL_DEVICE_TYPE_CPU;
+						break;
+					case 'g':
+						devType = CL_DEVICE_TYPE_GPU;
+						break;
+				}
+			}
+			else if (nDims < 3)
+				dims[nDims++] = atoi(argv[i]);
+		}
+	}
+	size_t M = dims[0];
+	size_t N = (nDims > 1) ? dims[1] : M;
+	size_t K = (nDims > 2) ? dims[2] : M;
+	if (nReps < 1)
+		nReps = 1;
+	// (Whether WPT divides the tile size is checked once both are known)
+	if (wpt < 0)
+	{
+		std::cerr << "WPT (" << wpt << ") must be positive.\n";
+		return 1;
+	}
+
+	// Matrices this small are faster on the host than the launch and the
+	// transfers (see preferHost); so is a plain run with no device. Asking
+	// for a device type or for kernel settings always uses a device.
+	bool plain = !tune && (devType == CL_DEVICE_TYPE_DEFAULT) && (tileSize <= 0) && (wpt <= 0);
+	OpenCLRuntime* rt = nullptr;
+	if (!plain || !preferHost(8.0 * (M*K + K*N + M*N), 2.0 * M * N * K))
+		rt = OpenCLRuntime::get(devType, true); // needs cl_khr_fp64
+	if (rt == nullptr)
+	{
+		if (!plain)
+		{
+			std::cerr << "-tune, -tile=, -wpt=, and -a/-c/-g need an OpenCL device\n";
+			return 1;
+		}
+		return (do_hostMatrixMultiply(M, N, K, nReps) == 0) ? 0 : 1;
+	}
+
+	int nBad = do_MatrixMultiply(*rt, runBlocked, runBT, M, N, K, tileSize, wpt, tune, nReps);
+
+	return (nBad == 0) ? 0 : 1;
+}
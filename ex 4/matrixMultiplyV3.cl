@@ -0,0 +1,88 @@
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+
+// TILE_SIZE and WPT ("work per thread") are normally supplied at build time
+// (e.g., "-DTILE_SIZE=32 -DWPT=4"). WPT must divide TILE_SIZE.
+#ifndef TILE_SIZE
+#define TILE_SIZE 32
+#endif
+#ifndef WPT
+#define WPT 4
+#endif
+// Each work-group is TILE_SIZE x RTS work-items and computes one
+// TILE_SIZE x TILE_SIZE tile of C.
+#define RTS (TILE_SIZE/WPT)
+
+// Register-blocked version of matrixMultiplyTiled (see matrixMultiplyV2.cl).
+// Each work-item computes WPT elements of one column of the tile, holding
+// the partial sums in registers, so each value read from Btile is reused
+// WPT times.
+//
+// C (M x N) = A (M x K) * B (K x N); all matrices stored in row-major order.
+// The global size is { N rounded up to TILE_SIZE, (M rounded up to TILE_SIZE)/WPT }.
+__kernel
+void matrixMultiplyBlocked(__global const double* A, __global const double* B, __global double* C,
+	int M, int N, int K)
+{
+	__local double Atile[TILE_SIZE][TILE_SIZE];
+	__local double Btile[TILE_SIZE][TILE_SIZE];
+
+	int localCol = get_local_id(0);
+	int localRow = get_local_id(1); // 0 <= localRow < RTS
+	int col = get_group_id(0)*TILE_SIZE + localCol;
+	int tileRow = get_group_id(1)*TILE_SIZE;
+
+	double acc[WPT];
+	for (int w=0 ; w<WPT ; w++)
+		acc[w] = 0.0;
+
+	int numTiles = (K + TILE_SIZE - 1) / TILE_SIZE;
+	for (int t=0 ; t<numTiles ; t++)
+	{
+		for (int w=0 ; w<WPT ; w++)
+		{
+			int r = localRow + w*RTS;
+			int aRow = tileRow + r;
+			int aCol = t*TILE_SIZE + localCol;
+			int bRow = t*TILE_SIZE + r;
+			Atile[r][localCol] = ((aRow < M) && (aCol < K)) ? A[aRow*K + aCol] : 0.0;
+			Btile[r][localCol] = ((bRow < K) && (col < N)) ? B[bRow*N + col] : 0.0;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+
+		for (int k=0 ; k<TILE_SIZE ; k++)
+		{
+			double b = Btile[k][localCol];
+			for (int w=0 ; w<WPT ; w++)
+				acc[w] += Atile[localRow + w*RTS][k] * b;
+		}
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	for (int w=0 ; w<WPT ; w++)
+	{
+		int row = tileRow + localRow + w*RTS;
+		if ((row < M) && (col < N))
+			C[row*N + col] = acc[w];
+	}
+}
+
+// C (M x N) = A (M x K) * B (K x N), where B is supplied transposed: BT is
+// N x K, so each work-item walks one row of A and one row of BT with unit
+// stride. No local memory; this is the layout CPU devices like best since
+// the inner loop is a contiguous dot product the compiler can vectorize.
+__kernel
+void matrixMultiplyTransposedB(__global const double* A, __global const double* BT, __global double* C,
+	int M, int N, int K)
+{
+	int col = get_global_id(0);
+	int row = get_global_id(1);
+	if ((row < M) && (col < N))
+	{
+		__global const double* aRow = A + row*K;
+		__global const double* bRow = BT + col*K;
+		double sum = 0.0;
+		for (int k=0 ; k<K ; k++)
+			sum += aRow[k] * bRow[k];
+		C[row*N + col] = sum;
+	}
+}
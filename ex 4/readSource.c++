@@ -1,53 +0,0 @@
-#include <stdio.h>
-#include <cstdlib>
-
-// A common utility extracted from the source code associated with
-// the book "Heterogeneous Computing with OpenCL".
-
-// This function reads in a text file and stores it as a char pointer
-const char* readSource(const char* kernelPath) {
-
-   FILE *fp;
-   char *source;
-   long int size;
-
-   printf("Program file is: %s\n", kernelPath);
-
-   fp = fopen(kernelPath, "rb");
-   if(!fp) {
-      printf("Could not open kernel file\n");
-      exit(-1);
-   }
-   int status = fseek(fp, 0, SEEK_END);
-   if(status != 0) {
-      printf("Error seeking to end of file\n");
-      exit(-1);
-   }
-   size = ftell(fp);
-   if(size < 0) {
-      printf("Error getting file position\n");
-      exit(-1);
-   }
-
-   rewind(fp);
-
-   source = (char *)malloc(size + 1);
-
-   int i;
-   for (i = 0; i < size+1; i++) {
-      source[i]='\0';
-   }
-
-   if(source == NULL) {
-      printf("Error allocating space for the kernel source\n");
-      exit(-1);
-   }
-
-   fread(source, 1, size, fp);
-   source[size] = '\0';
-
-	//printf("Returning file:\n%s\n", source);
-
-   return source;
-}
-